@@ -0,0 +1,861 @@
+// pagu's benchmarks, built with the editor's internals by `make bench`
+#define PAGU_BENCH
+#include "pagu.c"
+
+// the standard workloads behind `make bench`
+static const struct {
+    const char *name;
+    int lines;  // of generated C, or
+    int mb;     // one line this long
+    const char *script;
+} bench_suite_runs[] = {
+    {"c-1m", 1000000, 0,
+     "goto 500000\n"
+     "type int x = 1;\\n\n"
+     "key down 200\n"
+     "key pgdn 50\n"
+     "key pgup 50\n"
+     "find strtoul\n"
+     "key end\n"
+     "key backspace 20\n"
+     "key undo 10\n"
+     "goto 1000000\n"
+     "key save\n"},
+    {"line-100m", 0, 100,
+     "goto 2 50000000\n"
+     "type hello, world\n"
+     "key right 200\n"
+     "key backspace 50\n"
+     "key home\n"
+     "key end\n"
+     "key undo 5\n"
+     "key save\n"},
+    {"paste-10k", 100, 0,
+     "goto 50\n"
+     "paste-lines 10000\n"
+     "key pgup 20\n"
+     "key pgdn 20\n"
+     "key undo\n"
+     "key redo\n"
+     "key save\n"},
+};
+
+static int bench_suite() {
+    for (size_t i = 0; i < sizeof(bench_suite_runs) / sizeof(bench_suite_runs[0]); i++) {
+        char tmp[] = "/tmp/pagu-bench-XXXXXX.c";
+        int fd = mkstemps(tmp, 2);
+        FILE *fp = fd == -1 ? NULL : fdopen(fd, "w");
+        if (fp == NULL) {
+            perror(tmp);
+            return 1;
+        }
+        if (bench_suite_runs[i].mb) {
+            const char *chunk = "if (a[i] != b) { c += \"s\"; } /* x */ ";
+            fputs("int main() {\n", fp);
+            for (long n = 0; n < (long)bench_suite_runs[i].mb << 20; n += strlen(chunk)) {
+                fputs(chunk, fp);
+            }
+            fputs("\n}\n", fp);
+        } else {
+            size_t len;
+            char *c = bench_load(NULL, 1, &len);
+            int per = 0;
+            for (size_t k = 0; k < len; k++) {
+                per += c[k] == '\n';
+            }
+            for (int n = 0; n < bench_suite_runs[i].lines; n += per) {
+                fwrite(c, 1, len, fp);
+            }
+            free(c);
+        }
+        fclose(fp);
+        char *script = strdup(bench_suite_runs[i].script);
+        int r = bench_replay_script(script, bench_suite_runs[i].name, tmp);
+        free(script);
+        unlink(tmp);
+        if (r) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// counts every occurrence line by line, the way e_find_scan does
+static long bench_find_count(int (*fn)(const char *, int, const char *, int),
+                             const char *buf, size_t len, const char *q, int qlen) {
+    long hits = 0;
+    const char *p = buf;
+    const char *end = buf + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        int n = (nl ? nl : end) - p;
+        int col = 0;
+        int k;
+        while (qlen <= n - col && (k = fn(&p[col], n - col, q, qlen)) != -1) {
+            hits++;
+            col += k + 1;
+        }
+        p += n + 1;
+    }
+    return hits;
+}
+
+static int bench_memmem(const char *s, int len, const char *q, int qlen) {
+    const char *p = memmem(s, len, q, qlen);
+    return p ? p - s : -1;
+}
+
+static int bench_find(char *query, char *path) {
+    size_t len;
+    char *buf = bench_load(path, 64 << 20, &len);
+    if (buf == NULL) {
+        return 1;
+    }
+    int qlen = strlen(query);
+    printf("find \"%s\": %.1f MB %s\n", query, len / 1e6,
+           path ? path : "(synthetic)");
+    struct e_find_impl impls[2 + sizeof(e_find_impls) / sizeof(e_find_impls[0])];
+    int n = 0;
+    impls[n++] = (struct e_find_impl){"memmem", bench_memmem, e_cpu_any};
+    impls[n++] = (struct e_find_impl){"e_find_in", e_find_in, e_cpu_any};
+    for (unsigned int j = 0; j < sizeof(e_find_impls) / sizeof(e_find_impls[0]); j++) {
+        if (e_find_impls[j].supported()) {
+            impls[n++] = e_find_impls[j];
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        double best = 1e9;
+        long hits = 0;
+        for (int pass = 0; pass < 3; pass++) {
+            double t0 = bench_now();
+            hits = bench_find_count(impls[j].fn, buf, len, query, qlen);
+            double dt = bench_now() - t0;
+            if (dt < best) best = dt;
+        }
+        printf("  %-9s %8.1f MB/s  (%ld matches)\n", impls[j].name,
+               len / best / 1e6, hits);
+    }
+    free(buf);
+    return 0;
+}
+
+// counts matches line by line with e_re_find, or with regexec as the
+// reference; both report leftmost-longest matches and skip empty ones
+static long bench_regex_count(struct e_regex *re, regex_t *posix,
+                              const char *buf, size_t len) {
+    long hits = 0;
+    const char *p = buf;
+    const char *end = buf + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        int n = (nl ? nl : end) - p;
+        int col = 0;
+        while (col <= n) {
+            int at, mlen;
+            if (re) {
+                if ((at = e_re_find(re, p, n, col, &mlen)) == -1) break;
+            } else {
+                regmatch_t m = {col, n};
+                if (regexec(posix, p, 1, &m, REG_STARTEND | (col ? REG_NOTBOL : 0))) break;
+                at = m.rm_so;
+                mlen = m.rm_eo - m.rm_so;
+                if (mlen == 0) {
+                    col = at + 1;
+                    continue;
+                }
+            }
+            hits++;
+            col = at + mlen;
+        }
+        p += n + 1;
+    }
+    return hits;
+}
+
+static int bench_regex(char *pattern, char *path) {
+    const char *err;
+    struct e_regex *re = e_re_compile(pattern, &err);
+    if (re == NULL) {
+        fprintf(stderr, "%s: %s\n", pattern, err);
+        return 1;
+    }
+    regex_t posix;
+    if (regcomp(&posix, pattern, REG_EXTENDED)) {
+        fprintf(stderr, "%s: regcomp failed\n", pattern);
+        return 1;
+    }
+    size_t len;
+    char *buf = bench_load(path, 100 << 20, &len);
+    if (buf == NULL) {
+        return 1;
+    }
+    printf("regex \"%s\": %.1f MB %s\n", pattern, len / 1e6,
+           path ? path : "(synthetic)");
+    for (int m = 0; m < 2; m++) {
+        double t0 = bench_now();
+        long hits = bench_regex_count(m ? re : NULL, &posix, buf, len);
+        double dt = bench_now() - t0;
+        printf("  %-8s %8.1f MB/s  (%ld matches)\n", m ? "dfa" : "regexec",
+               len / dt / 1e6, hits);
+    }
+    e_re_free(re);
+    regfree(&posix);
+    free(buf);
+    return 0;
+}
+
+// indexes the same buffer on one thread and on all of them; the rows have
+// to come out identical
+static int bench_load_rows(char *path) {
+    size_t len;
+    char *buf = bench_load(path, 512 << 20, &len);
+    if (buf == NULL) {
+        return 1;
+    }
+    printf("load: %.1f MB %s\n", len / 1e6, path ? path : "(synthetic)");
+    e_row *rows[2];
+    int n[2];
+    for (int m = 0; m < 2; m++) {
+        double best = 1e9;
+        for (int pass = 0; pass < 3; pass++) {
+            double t0 = bench_now();
+            n[m] = e_index_rows(buf, len, m ? 0 : 1, &rows[m]);
+            double dt = bench_now() - t0;
+            if (dt < best) best = dt;
+            if (pass < 2) free(rows[m]);
+        }
+        printf("  %-8s %8.1f MB/s  (%d rows)\n", m ? "parallel" : "serial",
+               len / best / 1e6, n[m]);
+    }
+    int same = n[0] == n[1];
+    for (int j = 0; same && j < n[0]; j++) {
+        same = rows[0][j].chars == rows[1][j].chars &&
+               rows[0][j].size == rows[1][j].size &&
+               rows[0][j].flags == rows[1][j].flags;
+    }
+    printf("  rows %s\n", same ? "identical" : "DIFFER");
+    free(rows[0]);
+    free(rows[1]);
+    free(buf);
+    return !same;
+}
+
+// resident heap and stack, leaving out pages of the mapped file
+static double bench_anon_mb() {
+    long pages = 0, resident = 0, shared = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld %ld", &pages, &resident, &shared) != 3) {
+            resident = shared = 0;
+        }
+        fclose(fp);
+    }
+    return (resident - shared) * (double)sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+// memory over file size after opening, after paging through every row and
+// after editing every 1000th row
+static int bench_memory(char *path, int cache) {
+    char tmp[] = "/tmp/pagu-bench-XXXXXX";
+    if (path == NULL) {
+        size_t len;
+        char *buf = bench_load(NULL, 256 << 20, &len);
+        int fd = mkstemp(tmp);
+        if (fd == -1 || write(fd, buf, len) != (ssize_t)len) {
+            perror(tmp);
+            return 1;
+        }
+        close(fd);
+        free(buf);
+        path = tmp;
+    }
+    E.screen_rows = 48;
+    E.screen_cols = 160;
+    E.buf.cache.cap = cache > 0 ? cache : PAGU_RENDER_CACHE;
+    e_frame_resize();
+    double base = bench_anon_mb();
+    e_open(path);
+    double file = E.buf.map_len / 1e6;
+    printf("memory: %.1f MB %s, %d rows, hl cache %d rows\n", file,
+           path == tmp ? "(synthetic)" : path, E.buf.n_rows, E.buf.cache.cap);
+
+    double mb = bench_anon_mb() - base;
+    printf("  open     %8.1f MB  (%.3f x file)\n", mb, mb / file);
+    for (E.buf.row_off = 0; E.buf.row_off < E.buf.n_rows; E.buf.row_off += E.screen_rows) {
+        e_draw_rows();
+    }
+    mb = bench_anon_mb() - base;
+    printf("  scrolled %8.1f MB  (%.3f x file, %d hl kept)\n", mb,
+           mb / file, E.buf.cache.n);
+    E.buf.undo.off++;
+    int j = 0;
+    for (e_row *row = e_row_at(0); row; row = e_row_next(row), j++) {
+        if (j % 1000 == 0) {
+            e_row_insert_char(row, 0, '#');
+        }
+    }
+    E.buf.undo.off--;
+    mb = bench_anon_mb() - base;
+    printf("  edited   %8.1f MB  (%.3f x file, %d rows copied)\n", mb,
+           mb / file, (j + 999) / 1000);
+    e_row *row = e_row_at(0);
+    long allocs = E.stats.allocs;
+    for (j = 0; j < 20000; j++) {
+        e_row_insert_char(row, row->size, 'x');
+    }
+    printf("  typed    20000 chars, %ld moves; %.1f MB live, %.1f MB slack, "
+           "%d slabs\n", E.stats.allocs - allocs, E.buf.mem.live / 1e6,
+           (E.buf.mem.used - E.buf.mem.live) / 1e6, E.buf.mem.nslabs);
+    double t0 = bench_now();
+    e_close();
+    printf("  closed   in %.3f ms\n", (bench_now() - t0) * 1e3);
+    if (path == tmp) {
+        unlink(tmp);
+    }
+    return 0;
+}
+
+// one keystroke as the editor loop sees it: the edit, then the frame
+static double bench_keystroke(int c) {
+    double t0 = bench_now();
+    if (c == BACKSPACE) {
+        e_delete_char();
+    } else {
+        e_insert_char(c);
+    }
+    e_scroll();
+    e_draw_rows();
+    return bench_now() - t0;
+}
+
+static void bench_typing(const char *name, int cy, int cx) {
+    E.buf.cy = cy;
+    E.buf.cx = cx;
+    E.buf.row_off = cy;
+    double t0 = bench_now();
+    e_scroll();
+    e_draw_rows();
+    double first = bench_now() - t0;
+    double sum[2] = {0}, max[2] = {0};
+    for (int k = 0; k < 2; k++) {
+        for (int j = 0; j < 2000; j++) {
+            double dt = bench_keystroke(k ? BACKSPACE : "int x;"[j % 6]);
+            sum[k] += dt;
+            max[k] = dt > max[k] ? dt : max[k];
+        }
+    }
+    printf("  %-6s first frame %8.3f ms, typing %6.2f us (max %7.2f), "
+           "erasing %6.2f us (max %7.2f)\n", name, first * 1e3,
+           sum[0] / 2000 * 1e6, max[0] * 1e6, sum[1] / 2000 * 1e6, max[1] * 1e6);
+}
+
+// keystroke latency in the middle of a line of mb megabytes against the
+// same on a short line of the same file
+static int bench_longline(int mb) {
+    char tmp[] = "/tmp/pagu-bench-XXXXXX.c";
+    int fd = mkstemps(tmp, 2);
+    size_t len = (size_t)(mb > 0 ? mb : 100) << 20;
+    char *buf = malloc(len + 64);
+    const char *chunk = "if (a[i] != b) { c += \"s\"; } /* x */ ";
+    size_t n = strlen("int main() {\n");
+    memcpy(buf, "int main() {\n", n);
+    while (n < len) {
+        size_t k = strlen(chunk) < len - n ? strlen(chunk) : len - n;
+        memcpy(&buf[n], chunk, k);
+        n += k;
+    }
+    memcpy(&buf[n], "\n}\n", 3);
+    n += 3;
+    if (fd == -1 || write(fd, buf, n) != (ssize_t)n) {
+        perror(tmp);
+        return 1;
+    }
+    close(fd);
+    free(buf);
+    E.screen_rows = 48;
+    E.screen_cols = 160;
+    E.buf.cache.cap = PAGU_RENDER_CACHE;
+    e_frame_resize();
+    e_open(tmp);
+    printf("longline: %.1f MB line, %d rows\n", len / 1e6, E.buf.n_rows);
+    E.buf.undo.off++;
+    bench_typing("short", 0, 4);
+    bench_typing("long", 1, e_row_at(1)->size / 2);
+    e_row *row = e_row_at(1);
+    printf("  long row: %d segments, %d hl bytes\n",
+           (row->flags & ROW_CHUNKED) ? row->segs->n : 0,
+           (row->flags & ROW_CHUNKED) ? row->segs->hl_len : row->size);
+    E.buf.undo.off--;
+    e_close();
+    unlink(tmp);
+    return 0;
+}
+
+// the keyword matcher of the old highlighter
+static int bench_kw_linear(char **keywords, const char *s, int len, int *klen) {
+    for (int j = 0; keywords[j]; j++) {
+        int n = strlen(keywords[j]);
+        int kw2 = keywords[j][n - 1] == '|';
+        if (kw2) n--;
+        if (n <= len && !strncmp(s, keywords[j], n) &&
+            (n == len || is_separator(s[n]))) {
+            *klen = n;
+            return kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+        }
+    }
+    return HL_NORMAL;
+}
+
+// a keyword lookup through the lexer's trie states: the word ends on
+// a move that recolors the bytes behind it
+static int bench_kw_trie(const struct e_lex *lx, const char *s, int len, int *klen) {
+    if (is_separator((unsigned char)s[0])) {
+        return HL_NORMAL;
+    }
+    unsigned int st = LEX_SEP * lx->n_cls;
+    for (int i = 0; i <= len; i++) {
+        struct e_lex_move m = i < len ? lx->moves[st + lx->cls[(unsigned char)s[i]]]
+                                      : lx->eol[st / lx->n_cls];
+        if (m.back) {
+            *klen = m.back;
+            return m.hl >> 4;
+        }
+        st = m.next;
+        if (i == len || st < 3 * (unsigned int)lx->n_cls) {
+            return HL_NORMAL;
+        }
+    }
+    return HL_NORMAL;
+}
+
+static int bench_keywords(char *path) {
+    size_t len;
+    char *buf = bench_load(path, 4 << 20, &len);
+    if (buf == NULL) {
+        return 1;
+    }
+    printf("keywords: %.1f MB %s\n", len / 1e6, path ? path : "(synthetic)");
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct e_syntax *syn = &HLDB[j];
+        if (e_syntax_compile(syn) == -1) {
+            continue;
+        }
+        int n = 0;
+        while (syn->keywords[n]) n++;
+
+        double best[2] = {1e9, 1e9};
+        long hits[2] = {0, 0};
+        for (int pass = 0; pass < 2; pass++) {
+            for (int m = 0; m < 2; m++) {
+                double t0 = bench_now();
+                long h = 0;
+                int prev_sep = 1;
+                for (size_t i = 0; i < len; i++) {
+                    if (prev_sep) {
+                        int rest = len - i > 4096 ? 4096 : len - i;
+                        int klen = 0;
+                        int kw = m ? bench_kw_trie(syn->lex, &buf[i], rest, &klen)
+                                   : bench_kw_linear(syn->keywords, &buf[i], rest, &klen);
+                        if (kw != HL_NORMAL) {
+                            h++;
+                            i += klen - 1;
+                            prev_sep = 0;
+                            continue;
+                        }
+                    }
+                    prev_sep = is_separator((unsigned char)buf[i]);
+                }
+                double dt = bench_now() - t0;
+                if (dt < best[m]) best[m] = dt;
+                hits[m] = h;
+            }
+        }
+        printf("  %-4s %3d keywords  linear %8.1f MB/s  trie %8.1f MB/s  x%.1f  "
+               "(%ld/%ld matches)\n",
+               syn->filetype, n, len / best[0] / 1e6, len / best[1] / 1e6,
+               best[0] / best[1], hits[0], hits[1]);
+    }
+    free(buf);
+    return 0;
+}
+
+// the highlighter before syntaxes were compiled to tables
+static int bench_scan_loop(const char *s, int len, unsigned char *hl, int in_comment) {
+    memset(hl, HL_NORMAL, len);
+
+    char *scs = E.buf.syntax->singleline_comment_start;
+    char *mcs = E.buf.syntax->multiline_comment_start;
+    char *mce = E.buf.syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int prev_sep = 1;
+    int in_string = 0;
+
+    int i = 0;
+    while (i < len) {
+        char c = s[i];
+        unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
+
+        if (scs_len && !in_string && !in_comment) {
+            if (i + scs_len <= len && !memcmp(&s[i], scs, scs_len)) {
+                memset(&hl[i], HL_COMMENT, len - i);
+                break;
+            }
+        }
+
+        if (mcs_len && mce_len && !in_string) {
+            if (in_comment) {
+                hl[i] = HL_MLCOMMENT;
+                if (i + mce_len <= len && !memcmp(&s[i], mce, mce_len)) {
+                    memset(&hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
+                } else {
+                    i++;
+                    continue;
+                }
+            } else if (i + mcs_len <= len && !memcmp(&s[i], mcs, mcs_len)) {
+                memset(&hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if (E.buf.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+            if (in_string) {
+                hl[i] = HL_STRING;
+                if (c == '\\' && i + 1 < len) {
+                    hl[i + 1] = HL_STRING;
+                    i += 2;
+                    continue;
+                }
+                if (c == in_string) in_string = 0;
+                i++;
+                prev_sep = 1;
+                continue;
+            } else {
+                if (c == '"' || c == '\'') {
+                    in_string = c;
+                    hl[i] = HL_STRING;
+                    i++;
+                    continue;
+                }
+            }
+        }
+
+        if (E.buf.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER)) {
+                hl[i] = HL_NUMBER;
+                i++;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (prev_sep) {
+            int klen;
+            int kw = bench_kw_linear(E.buf.syntax->keywords, &s[i], len - i, &klen);
+            if (kw != HL_NORMAL) {
+                memset(&hl[i], kw, klen);
+                i += klen;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        prev_sep = is_separator(c);
+        i++;
+    }
+    return in_comment;
+}
+
+static int bench_lexer(char *path) {
+    size_t len;
+    char *buf = bench_load(path, 16 << 20, &len);
+    if (buf == NULL) {
+        return 1;
+    }
+    e_syntax_load();
+    E.buf.filename = path ? path : "bench.c";
+    e_select_hl();
+    struct e_syntax *syn = E.buf.syntax;
+    if (syn == NULL) {
+        fprintf(stderr, "%s: no syntax for this file\n", E.buf.filename);
+        return 1;
+    }
+    struct e_lex *lx = syn->lex;
+    printf("lexer: %.1f MB %s, %s: %d states x %d classes, %.0f KB\n", len / 1e6,
+           path ? path : "(synthetic)", syn->filetype, lx->n_states, lx->n_cls,
+           lx->n_states * lx->n_cls * sizeof(struct e_lex_move) / 1e3);
+    // the loop only knows the built-in syntaxes' fields
+    int builtin = syn >= HLDB && syn < HLDB + HLDB_ENTRIES;
+    unsigned char *hl[2] = {malloc(len), malloc(len)};
+    double best[2] = {1e9, 1e9};
+    for (int pass = 0; pass < 3; pass++) {
+        for (int m = !builtin; m < 2; m++) {
+            double t0 = bench_now();
+            int state = 0;
+            for (size_t i = 0; i < len;) {
+                char *nl = memchr(&buf[i], '\n', len - i);
+                int n = (nl ? nl - buf : (long)len) - i;
+                state = m ? e_syntax_scan(&buf[i], n, &hl[m][i], state)
+                          : bench_scan_loop(&buf[i], n, &hl[m][i], state);
+                i += n + 1;
+            }
+            double dt = bench_now() - t0;
+            if (dt < best[m]) best[m] = dt;
+        }
+    }
+    if (builtin) {
+        long differ = 0;
+        for (size_t i = 0; i < len; i++) {
+            differ += buf[i] != '\n' && hl[0][i] != hl[1][i];
+        }
+        printf("  loop  %8.1f MB/s\n", len / best[0] / 1e6);
+        printf("  table %8.1f MB/s  x%.1f  (%ld bytes differ)\n", len / best[1] / 1e6,
+               best[0] / best[1], differ);
+    } else {
+        printf("  table %8.1f MB/s\n", len / best[1] / 1e6);
+    }
+    free(hl[0]);
+    free(hl[1]);
+    free(buf);
+    return 0;
+}
+
+// hash of every row's place, size and checkpoint, to compare two opens
+static uint64_t bench_rows_hash() {
+    uint64_t h = FNV64_INIT;
+    for (int i = 0; i < E.buf.n_rows; i++) {
+        e_row *row = &E.buf.row_block[i];
+        long long v[3] = {row->chars - E.buf.map, row->size,
+                          i < E.buf.hl_frontier ? row->hl_state : -1};
+        h = e_fnv64(v, sizeof(v), h);
+    }
+    return h;
+}
+
+// drops the file's pages so the next open reads it from the disk
+static void bench_evict(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// opens a big file with its pages evicted, scrolls halfway, and opens it
+// again through the sidecar left by the close
+static int bench_sidecar(char *path) {
+    char tmp[] = "/tmp/pagu-bench-XXXXXX.c";
+    if (path == NULL) {
+        size_t len;
+        char *buf = bench_load(NULL, 1024 << 20, &len);
+        int fd = mkstemps(tmp, 2);
+        if (fd == -1 || write(fd, buf, len) != (ssize_t)len) {
+            perror(tmp);
+            return 1;
+        }
+        close(fd);
+        free(buf);
+        path = tmp;
+    }
+    char dir[] = "/tmp/pagu-cache-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror(dir);
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", dir, 1);
+    e_init();
+    E.sidecar_min = 1;
+    E.journal_ms = 0;
+
+    bench_evict(path);
+    double t0 = bench_now();
+    if (e_open(path) == -1) {
+        perror(path);
+        return 1;
+    }
+    double cold = bench_now() - t0;
+    int n = E.buf.n_rows;
+    printf("sidecar: %s, %d rows\n", path, n);
+    printf("  open, no sidecar    %9.3f ms\n", cold * 1e3);
+    t0 = bench_now();
+    e_syntax_sync(n / 2);
+    printf("  hl to row %-9d %9.3f ms\n", n / 2, (bench_now() - t0) * 1e3);
+    E.buf.cy = n / 2;
+    E.buf.row_off = n / 2 - 10 > 0 ? n / 2 - 10 : 0;
+    uint64_t want = bench_rows_hash();
+    t0 = bench_now();
+    e_close();
+    printf("  close, writing it   %9.3f ms\n", (bench_now() - t0) * 1e3);
+
+    bench_evict(path);
+    t0 = bench_now();
+    e_open(path);
+    double warm = bench_now() - t0;
+    printf("  open, with sidecar  %9.3f ms  (%.1fx), at row %d\n", warm * 1e3,
+           cold / warm, E.buf.cy);
+    int same = E.buf.disk.indexed && E.buf.n_rows == n && E.buf.cy == n / 2 &&
+               E.buf.hl_frontier == n / 2 && bench_rows_hash() == want;
+    printf("  rows, states and cursor %s\n", same ? "identical" : "DIFFER");
+    t0 = bench_now();
+    e_close();
+    printf("  close, updating it  %9.3f ms\n", (bench_now() - t0) * 1e3);
+
+    char side[PATH_MAX + 16];
+    char *real;
+    if (e_sidecar_path(path, 0, side, sizeof(side), &real) == 0) {
+        struct stat st;
+        if (stat(side, &st) == 0) {
+            printf("  sidecar %.1f MB\n", st.st_size / 1e6);
+        }
+        unlink(side);
+        free(real);
+    }
+    char pagu[sizeof(dir) + 8];
+    snprintf(pagu, sizeof(pagu), "%s/pagu", dir);
+    rmdir(pagu);
+    rmdir(dir);
+    if (path == tmp) {
+        unlink(tmp);
+    }
+    return !same;
+}
+
+// hash of the buffer's text, to compare two ways of getting to it
+static uint64_t bench_text_hash() {
+    uint64_t h = FNV64_INIT;
+    for (e_row *row = e_row_at(0); row; row = e_row_next(row)) {
+        h = e_fnv64(e_row_flat(row), row->size, h);
+        h = e_fnv64("\n", 1, h);
+    }
+    return h;
+}
+
+// a session of typing with the journal off and on, then a crash: the
+// buffer goes without a save and a reopen replays the journal
+static int bench_journal() {
+    char tmp[] = "/tmp/pagu-bench-XXXXXX.c";
+    char dir[] = "/tmp/pagu-state-XXXXXX";
+    size_t len;
+    char *buf = bench_load(NULL, 16 << 20, &len);
+    int fd = mkstemps(tmp, 2);
+    if (fd == -1 || write(fd, buf, len) != (ssize_t)len || mkdtemp(dir) == NULL) {
+        perror(tmp);
+        return 1;
+    }
+    close(fd);
+    free(buf);
+    setenv("XDG_STATE_HOME", dir, 1);
+    e_init();
+    E.sidecar_min = 0;
+    E.tty = -1;
+    E.out = open("/dev/null", O_WRONLY);
+    E.screen_rows = 48 - 2;
+    E.screen_cols = 160;
+    e_frame_resize();
+    E.feed.on = 1;
+
+    struct abuf keys = ABUF_INIT;
+    int n_keys = 0;
+    for (int i = 0; i < 20000; i++) {
+        const char *k = i % 100 == 0 ? "\x1a" : i % 10 == 0 ? "x = f(y);\x7f\x7f);\r" : "x = f(y);\r";
+        ab_append(&keys, k, strlen(k));
+        n_keys += strlen(k);
+        if (i % 50 == 0) {
+            ab_append(&keys, "\x1b[B\x1b[B", 6);
+            n_keys += 2;
+        }
+    }
+    printf("journal: %d keys typed into %.1f MB\n", n_keys, len / 1e6);
+    uint64_t want = 0;
+    int same = 0;
+    for (int on = 0; on < 2; on++) {
+        E.journal_ms = on ? PAGU_JOURNAL_MS : 0;
+        e_open(tmp);
+        E.buf.cy = E.buf.n_rows / 2;
+        struct bench_op op = {0};
+        bench_batch(&op, keys.b, keys.len);
+        printf("  journal %-3s  %8.3f ms, %.3f us/key", on ? "on" : "off", op.edit * 1e3,
+               op.edit * 1e6 / n_keys);
+        if (!on) {
+            printf("\n");
+            want = bench_text_hash();
+            E.buf.dirty = 0;
+            e_close();
+            continue;
+        }
+        e_journal_flush_all();
+        off_t size = lseek(E.buf.journal.fd, 0, SEEK_END);
+        printf(", %lld bytes, %.2f bytes/key\n", (long long)size, (double)size / n_keys);
+
+        // the journal outlives the buffer, as after a hangup
+        close(E.buf.journal.fd);
+        E.buf.journal.fd = -1;
+        E.buf.dirty = 0;
+        e_close();
+        double t0 = bench_now();
+        e_open(tmp);
+        e_journal_answer("y");
+        printf("  recovered in %8.3f ms: %s\n", (bench_now() - t0) * 1e3, E.statusmsg);
+        same = bench_text_hash() == want;
+        printf("  text %s\n", same ? "identical" : "DIFFERS");
+        e_close();
+    }
+    ab_free(&keys);
+    close(E.out);
+    char pagu[sizeof(dir) + 8];
+    snprintf(pagu, sizeof(pagu), "%s/pagu", dir);
+    rmdir(pagu);
+    rmdir(dir);
+    unlink(tmp);
+    return !same;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s suite|find|regex|load|memory|longline|lexer|sidecar|journal|keywords|replay ...\n", argv[0]);
+        return 1;
+    }
+    argc--;
+    argv++;
+    if (!strcmp(argv[0], "suite")) {
+        return bench_suite();
+    }
+    if (!strcmp(argv[0], "find") && argc > 1) {
+        return bench_find(argv[1], argc > 2 ? argv[2] : NULL);
+    }
+    if (!strcmp(argv[0], "regex") && argc > 1) {
+        return bench_regex(argv[1], argc > 2 ? argv[2] : NULL);
+    }
+    if (!strcmp(argv[0], "load")) {
+        return bench_load_rows(argc > 1 ? argv[1] : NULL);
+    }
+    if (!strcmp(argv[0], "memory")) {
+        return bench_memory(argc > 1 && *argv[1] ? argv[1] : NULL, argc > 2 ? atoi(argv[2]) : 0);
+    }
+    if (!strcmp(argv[0], "longline")) {
+        return bench_longline(argc > 1 ? atoi(argv[1]) : 0);
+    }
+    if (!strcmp(argv[0], "lexer")) {
+        return bench_lexer(argc > 1 ? argv[1] : NULL);
+    }
+    if (!strcmp(argv[0], "sidecar")) {
+        return bench_sidecar(argc > 1 ? argv[1] : NULL);
+    }
+    if (!strcmp(argv[0], "journal")) {
+        return bench_journal();
+    }
+    if (!strcmp(argv[0], "keywords")) {
+        return bench_keywords(argc > 1 ? argv[1] : NULL);
+    }
+    return e_bench(argc, argv);
+}
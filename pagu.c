@@ -3,29 +3,85 @@
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // defines
 #define PAGU_V "0.0.1"
 #define PAGU_TAB_STOP 4
 #define PAGU_QUIT_TIMES 1
+#define PAGU_INPUT_BUF 65536
+#define PAGU_ESC_TIMEOUT 50
+#define PAGU_PASTE_TIMEOUT 1000
+#define PAGU_UNDO_LIMIT (64 << 20) // bytes of undo history, env PAGU_UNDO_LIMIT overrides
+#define PAGU_UNDO_CHUNK 65536
+#define PAGU_FSYNC 2 // 0: never, 1: the file, 2: file and directory; env PAGU_FSYNC overrides
+#define PAGU_SAVE_IOV 1024
+#define PAGU_RE_STATES 1024
+#define PAGU_RE_MEMO 64
+#define PAGU_LOAD_CHUNK (4 << 20)
+#define PAGU_LOAD_THREADS 64
+#define PAGU_ADD_CHUNK (1 << 20)
+#define PAGU_RENDER_CACHE 4096
+#define PAGU_SLAB (256 << 10)
+#define PAGU_MEM_SMALL 4096
+#define PAGU_LONG_ROW (1 << 20)
+#define PAGU_SEG (64 << 10)
+#define PAGU_HL_MARGIN 1024
+#define PAGU_SYNC_ROWS 10000
+#define PAGU_JOB_ROWS 4096
+#define PAGU_STREAM_CHUNK (1 << 20)
+#define PAGU_STREAM_LINES 0 // rows a stream keeps, 0 for all; env PAGU_STREAM_LINES overrides
+#define PAGU_FOLLOW_MS 250
+#define PAGU_PROF_EVENTS (1 << 16)
+#define PAGU_PROF_DEPTH 16
+#define PAGU_SIDECAR_MIN (16 << 20) // smallest file that keeps a sidecar index, 0 for none; env PAGU_SIDECAR_MIN overrides
+#define PAGU_SIDECAR_SAMPLES 64
+#define PAGU_JOURNAL_MS 1000 // how often edits are synced to the journal, 0 for none; env PAGU_JOURNAL_MS overrides
+#define PAGU_JOURNAL_BATCH (1 << 20)
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)
 #define HL_HIGHLIGHT_STRINGS (1 << 1)
 
+#define ROW_MAPPED (1 << 0) // chars is a view into E.buf.map, not NUL-terminated
+#define ROW_BLOCK (1 << 1)
+#define ROW_DAMAGED (1 << 2)
+#define ROW_ADDED (1 << 3)
+#define ROW_REF (1 << 4)
+#define ROW_NOTABS (1 << 5)
+#define ROW_CHUNKED (1 << 6) // text is in segs, hl covers a slice of it
+#define ROW_VIEW (ROW_MAPPED | ROW_ADDED)
+
+#define ATTR_COLOR 0x7f // SGR foreground, 0 for the default
+#define ATTR_INVERSE 0x80
+
 enum editor_key {
     BACKSPACE = 127,
     ARROW_LEFT = 1000,
@@ -36,7 +92,9 @@ enum editor_key {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_KEY,
+    JOB_KEY
 };
 
 enum editor_highlight {
@@ -50,49 +108,495 @@ enum editor_highlight {
     HL_MATCH
 };
 
-typedef struct {
-    int idx;
-    int size;
-    int r_size;
-    char *chars;
-    char *render;
+enum e_prof_phase {
+    PROF_WAIT = 0,
+    PROF_INPUT,
+    PROF_EDIT,
+    PROF_HL,
+    PROF_RENDER,
+    PROF_WRITE,
+    PROF_LATENCY,
+    PROF_PHASES
+};
+
+typedef struct e_row {
+    union {
+        char *chars;
+        struct e_segs *segs;
+    };
     unsigned char *hl;
-    int hl_open_comment;
+    int size;
+    int hl_state; // lexer state at the end of the row, 0 outside comments and strings
+    int flags;
+    int cache_slot;
+
+    // row store: implicit treap, a row's index is its in-order position
+    struct e_row *left, *right, *parent;
+    int count;
+    uint32_t prio;
 } e_row;
 
+// a long row's text in segments; hl covers only the slice around the viewport
+struct e_seg {
+    int len;
+    int hl_in; // lexer state entering the segment, -1 if stale
+    char data[PAGU_SEG - 2 * sizeof(int)];
+};
+#define SEG_ROOM ((int)sizeof(((struct e_seg *)0)->data))
+
+struct e_segs {
+    struct e_seg **seg;
+    int n, cap;
+    int hl_at, hl_len;
+    int hl_from;    // first segment whose successor's hl_in may be stale
+    int hl_end;     // state after the last segment, before the eol move, or -1
+    int hl_win_in;  // states at either end of hl; -1 once an edit lands outside
+    int hl_win_out;
+};
+
+struct e_lex_rule {
+    char *open, *close;
+    unsigned char hl;
+    unsigned char multiline;
+    unsigned char escape;
+};
+
+// one step of the highlighter
+struct e_lex_move {
+    uint16_t next;    // premultiplied by n_cls; a state in eol
+    unsigned char hl; // low nibble this byte's, high the recolored bytes'
+    unsigned char back;
+};
+
+struct e_lex {
+    unsigned char cls[256];
+    int n_cls, n_states;
+    struct e_lex_move *moves;
+    struct e_lex_move *eol;
+    struct e_lex_rule *block;
+    int block_state;
+};
+
 struct e_syntax {
     char *filetype;
     char **filematch;
-    char **keywords;
+    char **keywords; // a trailing '|' puts a word in the second class
     char *singleline_comment_start;
     char *multiline_comment_start;
     char *multiline_comment_end;
     int flags;
+    char *separators;
+    struct e_lex_rule *rules;
+    int n_rules;
+    struct e_lex *lex;
 };
 
-typedef struct {
+struct e_cell {
+    char ch;
+    unsigned char attr;
+};
+
+// durations in ns, 4 buckets per power of two
+struct e_hist {
+    unsigned int n[256];
+    long count;
+    long long total, max;
+};
+
+struct e_prof_event {
+    long long at, dur;
+    int phase;
+};
+
+struct abuf {
+    char *b;
+    int len;
+    int cap;
+};
+
+#define ABUF_INIT {NULL, 0, 0}
+
+// undo journal: one record per row operation, grouped per keypress
+enum undo_op {
+    UNDO_INSERT = 0, // ops come in inverse pairs, op ^ 1 undoes op
+    UNDO_DELETE,
+    UNDO_INSERT_ROW,
+    UNDO_DEL_ROW
+};
+
+struct e_undo_rec {
+    struct e_undo_rec *prev, *next;
+    uint32_t group;
+    int op;
+    int row, at;
+    int len, cap;
+    int bx, by;
+    int ax, ay;
+    char text[];
+};
+
+struct e_undo_chunk {
+    struct e_undo_chunk *next;
+    size_t size, used;
+    char data[];
+};
+
+// add buffer: text of inserted rows, never changed
+struct e_add_chunk {
+    struct e_add_chunk *next;
+    size_t size, used;
+    char data[];
+};
+
+// row memory: slabs in size classes about 1.25x apart
+struct e_slab {
+    struct e_slab *next;
+    size_t size;
+    char data[];
+};
+
+struct e_big {
+    struct e_big *prev, *next;
+    size_t cap;
+    size_t pad;
+    char data[];
+};
+
+#define MEM_CLASSES 23
+
+struct e_match {
+    int row, col, len;
+};
+
+struct e_find_job {
+    char *query;
+    int qlen;
+    struct e_regex *re;
+    e_row *row;
+    int idx;
+    struct e_match *m;
+    int n, cap;
+    unsigned long gen;
+    unsigned int seq;
+    char *text;
+    int text_cap;
+};
+
+struct e_load_part {
+    char *p, *end;
+    e_row *rows;
+    int n;
+    pthread_t thread;
+};
+
+struct e_file_key {
+    uint64_t size;
+    int64_t mtime, mtime_ns;
+    uint64_t sample;
+};
+
+// sidecar in $XDG_CACHE_HOME/pagu: header, path, index, hl states
+struct e_sidecar {
+    char magic[8];
+    struct e_file_key key;
+    uint64_t lex; // hash of the tables the hl states are for, 0 for none
+    int32_t n_rows;
+    int32_t n_hl;
+    int32_t cx, cy, row_off, col_off;
+    int32_t path_len;
+};
+
+struct e_sidecar_row {
+    uint32_t size;
+    uint32_t skip;
+};
+
+// journal in $XDG_STATE_HOME/pagu: header, path, row operations
+struct e_journal_head {
+    char magic[8];
+    struct e_file_key key;
+    int32_t path_len;
+    int32_t pad;
+};
+
+struct e_journal_rec {
+    int32_t op;
+    int32_t row, at;
+    int32_t len;
+};
+
+// regex: Thompson NFA run as lazily built DFAs
+enum re_node_type {
+    RE_EMPTY = 0,
+    RE_CHAR,
+    RE_CAT,
+    RE_ALT,
+    RE_STAR,
+    RE_PLUS,
+    RE_QUEST,
+    RE_BOL,
+    RE_EOL
+};
+
+struct re_node {
+    int type;
+    int cls;
+    struct re_node *a, *b;
+};
+
+enum re_op {
+    RE_SET,
+    RE_SPLIT,
+    RE_AT_START,
+    RE_AT_END,
+    RE_MATCH
+};
+
+struct re_nstate {
+    int op;
+    int out, out1;
+    int cls;
+};
+
+struct re_dstate {
+    int *set;
+    int n;
+    uint32_t hash;
+};
+
+#define RE_ACCEPT 1     // a match ends here
+#define RE_ACCEPT_END 2 // ... if the scan also ends here
+#define RE_DEAD 4
+
+struct re_dfa {
+    int start;
+    int unanchored;
+    struct re_dstate **states;
+    int n;
+    int *trans;            // state * 256 + byte, -1 until first taken
+    unsigned char *accept;
+    int *table;
+    int init[2];
+    int resets;
+};
+
+struct e_regex {
+    const char *p;
+    const char *err;
+    struct re_node *nodes;
+    int nnodes, nodes_cap;
+    unsigned char (*cls)[32];
+    int ncls;
+    struct re_nstate *nfa;
+    int nn, ncap;
+
+    // closure scratch
+    int *stack;
+    uint32_t *mark;
+    uint32_t gen;
+    int *set;
+    int nset;
+
+    struct re_dfa fwd, rev;
+    unsigned char ends[256];
+    int end_byte;
+    int can_skip;
+    unsigned char *starts;
+    int starts_cap;
+    const char *starts_for;
+    int starts_len;
+    // forward-scan checkpoints of that row
+    int *memo_st, *memo_end;
+    int *walk_at, *walk_st;
+    int memo_cap;
+    int memo_resets;
+};
+
+#define UNDO_SIZE(len) ((sizeof(struct e_undo_rec) + (len) + 7) & ~(size_t)7)
+
+struct e_buffer {
     int cx, cy;
     int render_x;
     int row_off;
     int col_off;
-    int cx_off;
-    int screen_rows;
-    int screen_cols;
     int n_rows;
     int dirty;
-    e_row *row;
+    unsigned long gen;
+    e_row *rows;
     char *filename;
+    char *map;
+    size_t map_len;
+    struct e_add_chunk *add;
+    struct e_syntax *syntax;
+    int hl_frontier; // rows before this have a valid hl_state
+    int readonly;
+
+    struct {
+        int follow;
+        int fd;
+        int pipe;
+        int ring;
+        int more;
+        int partial; // the last row shows part, a line still being written
+        off_t off;
+        struct abuf part;
+    } stream;
+
+    struct {
+        struct e_slab *slabs;
+        char *bump, *end;
+        void *free[MEM_CLASSES];
+        struct e_big *big;
+        size_t live;
+        size_t used;
+        size_t slab;
+        size_t large;
+        int nslabs;
+    } mem;
+    e_row *row_block;
+
+    struct {
+        int on;
+        int indexed;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        unsigned long gen;
+    } disk;
+
+    struct {
+        int on;
+        int fd; // -1 until the first batch creates the journal
+        char *path;
+        struct e_file_key key;
+        struct abuf pending;
+        int last;
+        long long due;
+        struct {
+            int n, fd;
+            size_t start, end;
+        } offer;
+    } journal;
+
+    struct {
+        e_row **rows;
+        int n, cap;
+        int hand;
+    } cache;
+
+    struct {
+        struct e_match *m;
+        int n, cap;
+        int cur;
+        char *query;
+        int qlen;
+        int active;
+        int from_row, from_col;
+        int hl_row;
+        int regex;
+        const char *error;
+        unsigned int seq;
+        int pending;
+        int ready;
+    } find;
+
+    struct {
+        struct e_undo_chunk *head, *tail, *spare;
+        struct e_undo_rec *first, *last;
+        struct e_undo_rec *top;
+        size_t bytes, limit;
+        uint32_t group;
+        uint32_t dropped; // group whose start fell off, not recorded further
+        int kind;
+        int cx, cy;
+        int bx, by;
+        int off;          // not recording: loading or replaying
+    } undo;
+};
+
+typedef struct {
+    struct e_buffer buf;
+    struct e_buffer *bufs; // open buffers; E.buf's own slot is stale
+    int n_bufs, cur_buf;
+    size_t undo_limit;
+    int stream_lines;
+    long long sidecar_min;
+    int journal_ms;
+    int journal_offer;
+
+    int tty; // the terminal; stdin may be the stream being viewed
+    int out;
+
+    struct {
+        const char *keys;
+        size_t len;
+        int on;
+    } feed;
+    int cx_off;
+    int screen_rows;
+    int screen_cols;
     char statusmsg[80];
     time_t statusmsg_time;
-    struct e_syntax *syntax;
+    int fsync_policy;
+
+    struct e_cell *frame;
+    struct e_cell *prev_frame;
+    e_row **line_row;
+    int *line_num; // the number line_row[y] was drawn with
+    int frame_full;
+    int frame_col_off;
+    int frame_lnw;
+    int frame_cx, frame_cy;
+    struct abuf ob;
+    int show_stats;
+    struct {
+        long frames;
+        long bytes;
+        long allocs;
+        int frame_bytes;
+        int frame_lines;
+        int frame_allocs;
+    } stats;
+
+    struct {
+        int on;
+        long long start;
+        struct e_hist hist[PROF_PHASES];
+        long long child[PAGU_PROF_DEPTH];
+        int depth;
+        long long key_at;
+        struct e_prof_event *events;
+        unsigned int n_events;
+        char *trace;
+    } prof;
 
     struct termios orig_termios;
+    int sig_pipe[2];
+    int resized;
+    struct {
+        unsigned char buf[PAGU_INPUT_BUF];
+        unsigned int head, tail;
+    } in;
+    struct abuf paste;
+
+    // the worker runs while the main thread waits for input
+    struct {
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        atomic_int main_waiting;
+        int running;
+        struct e_find_job *search;
+    } worker;
+    int woken;
+    int hl_redraw;
 } editorConfig;
 
 editorConfig E;
 
 // file types
-char *C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
+char *C_HL_extensions[] = {".c", ".h", NULL};
 char *C_HL_keywords[] = {
   "switch", "if", "while", "for", "break", "continue", "return", "else",
   "struct", "union", "typedef", "static", "enum", "class", "case",
@@ -100,59 +604,178 @@ char *C_HL_keywords[] = {
   "void|", "NULL", NULL
 };
 
+char *CPP_HL_extensions[] = {".cpp", ".cc", ".cxx", ".hpp", ".hh", ".hxx", NULL};
+char *CPP_HL_keywords[] = {
+  "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
+  "break", "case", "catch", "class", "compl", "concept", "const",
+  "consteval", "constexpr", "constinit", "const_cast", "continue",
+  "co_await", "co_return", "co_yield", "decltype", "default", "delete",
+  "do", "dynamic_cast", "else", "enum", "explicit", "export", "extern",
+  "false", "final", "for", "friend", "goto", "if", "inline", "mutable",
+  "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator",
+  "or", "or_eq", "override", "private", "protected", "public", "register",
+  "reinterpret_cast", "requires", "return", "sizeof", "static",
+  "static_assert", "static_cast", "struct", "switch", "template", "this",
+  "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+  "union", "using", "virtual", "volatile", "while", "xor", "xor_eq", "NULL",
+  "bool|", "char|", "char8_t|", "char16_t|", "char32_t|", "double|",
+  "float|", "int|", "long|", "short|", "signed|", "unsigned|", "void|",
+  "wchar_t|", "size_t|", "ssize_t|", "ptrdiff_t|", "intptr_t|",
+  "uintptr_t|", "int8_t|", "int16_t|", "int32_t|", "int64_t|", "uint8_t|",
+  "uint16_t|", "uint32_t|", "uint64_t|", NULL
+};
+
 struct e_syntax HLDB[] = {
-    { "c", C_HL_extensions, C_HL_keywords, "//", "/*", "*/", HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS },
+    { "c", C_HL_extensions, C_HL_keywords, "//", "/*", "*/", HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS, NULL, NULL, 0, NULL },
+    { "c++", CPP_HL_extensions, CPP_HL_keywords, "//", "/*", "*/", HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS, NULL, NULL, 0, NULL },
 };
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+// syntaxes loaded from files at startup, tried before HLDB
+struct e_syntax **HLDB_files;
+int HLDB_n_files;
+
 // terminal
 void enable_raw_mode(void);
 void disable_raw_mode(void);
 void die(const char *);
+void e_input_init();
+int e_input_wait(int);
+int e_input_pending();
+void e_handle_resize();
+int e_next_timeout();
 int e_read_key();
+int e_read_paste();
 int get_window_size(int *, int *);
 int get_cursor_pos(int *, int *);
 
+// row store
+e_row *e_row_at(int);
+int e_row_idx(e_row *);
+e_row *e_row_next(e_row *);
+e_row *e_row_prev(e_row *);
+void rt_link(int, e_row *);
+void rt_unlink(e_row *);
+
+// row memory
+void *e_mem_alloc(size_t);
+void *e_mem_realloc(void *, size_t, size_t);
+void e_mem_free(void *, size_t);
+void e_mem_free_all();
+
 // row operations
 void e_insert_row(int, char *, size_t);
 void e_update_row(e_row *);
+void e_row_render(e_row *);
+void e_row_own(e_row *);
+int e_row_span(e_row *, int, const char **);
+void e_row_copy(e_row *, int, int, char *);
+void e_row_chunk(e_row *);
+char *e_row_flat(e_row *);
+void e_row_window(e_row *, int, int);
+char *e_add_text(const char *, size_t);
+void e_cache_add(e_row *);
+void e_cache_evict(e_row *);
 int e_cxrx(e_row *, int);
 int e_rxcx(e_row *, int);
+void e_row_insert_str(e_row *, int, const char *, size_t);
+void e_row_delete_str(e_row *, int, int);
 void e_row_insert_char(e_row *, int, int);
 void e_row_delete_char(e_row *, int);
 void e_free_row(e_row *);
 void e_del_row(int);
 void e_row_append_str(e_row *, char *, size_t);
+void e_row_truncate(e_row *, int);
 
 // editor operations
 void e_insert_char(int);
 void e_delete_char();
 void e_insert_newline();
+void e_insert_text(const char *, size_t);
+
+// undo
+void e_undo_begin(int);
+void e_undo_end();
+void e_undo_record(int, int, int, const char *, int);
+void e_undo_record_row(int, e_row *);
+void e_undo();
+void e_redo();
 
 // syntax highlighting
 int is_separator(int c);
+int e_syntax_compile(struct e_syntax *);
+int e_lex_compile(struct e_syntax *);
+void e_syntax_load();
+int e_syntax_scan(const char *, int, unsigned char *, int);
+int e_syntax_run(const char *, int, unsigned char *, int);
+void e_syntax_sync(int);
+int e_syntax_behind();
+void e_syntax_cascade(e_row *, int);
 void e_update_syntax(e_row *);
 int e_syntax_to_color(int);
+void e_syntax_reset();
 void e_select_hl();
 
 // file IO
-void e_open(char *);
-char *e_rows_to_string(int *);
+int e_open(char *);
+void e_stream_open(int, char *);
+int e_stream_read();
+void e_close();
+void e_open_mapped(char *, size_t);
+int e_index_rows(char *, size_t, int, e_row **);
+long long e_write_rows(int);
+int e_write_file(const char *, long long *);
 void e_save();
 
+// sidecar
+void e_sidecar_load(int, struct stat *, char *);
+void e_sidecar_store(struct e_buffer *);
+void e_sidecar_store_all();
+
+// journal
+void e_journal_open(int);
+void e_journal_offer();
+void e_journal_answer(const char *);
+void e_journal_record(int, int, int, const char *, int);
+void e_journal_flush(struct e_buffer *, int);
+void e_journal_flush_all();
+void e_journal_drop(struct e_buffer *);
+void e_journal_drop_all();
+void e_journal_saved();
+int e_journal_timeout();
+void e_journal_tick();
+
+// regex
+struct e_regex *e_re_compile(const char *, const char **);
+int e_re_find(struct e_regex *, const char *, int, int, int *);
+void e_re_free(struct e_regex *);
+
+// worker
+void e_worker_start();
+void e_worker_acquire();
+void e_worker_release();
+void e_worker_wake_main();
+int e_worker_submit(struct e_find_job *);
+
+// buffers
+void e_buffer_new();
+void e_buffer_switch(int);
+void e_buffer_close();
+int e_buffer_find(const char *);
+int e_buffers_dirty();
+void e_buffer_open();
+
 // find
+int e_find_in(const char *, int, const char *, int);
+void e_find_scan(const char *, int);
+void e_find_drop(int);
 void e_find();
 
 // append buffer
-struct abuf {
-    char *b;
-    int len;
-};
-
-#define ABUF_INIT {NULL, 0}
-
+void ab_reserve(struct abuf *, int);
 void ab_append(struct abuf *, const char *, int);
+void ab_append_cells(struct abuf *, const struct e_cell *, int);
 void ab_free(struct abuf *);
 
 // input
@@ -161,35 +784,93 @@ void e_move_cursor(int);
 
 // output
 void e_clear();
-void e_draw_rows(struct abuf *);
+void e_frame_resize();
+void e_flush_frame();
+void e_draw_rows();
 void e_scroll();
-void e_draw_bar(struct abuf *);
+void e_draw_bar();
 void e_set_status_msg(const char *, ...);
-void e_draw_msg(struct abuf *);
+void e_draw_msg();
 char *e_prompt(char *, void (*callback)(char *, int));
 
+// profile
+void e_prof_init();
+long long e_prof_begin();
+void e_prof_end(int, long long);
+void e_prof_key();
+void e_prof_frame();
+void e_prof_dump();
+long long e_hist_pct(struct e_hist *, int);
+
 // init
 void e_init();
+void e_term_init();
+
+// bench
+int e_bench(int, char **);
 
+#ifndef PAGU_BENCH
 int main(int argc, char **argv) {
+    if (argc >= 3 && !strcmp(argv[1], "--bench")) {
+        return e_bench(argc - 2, argv + 2);
+    }
     e_init();
+    e_term_init();
     enable_raw_mode();
-    if (argc >= 2) {
-        e_open(argv[1]);
+    e_input_init();
+    e_worker_start();
+    int opened = 0;
+    for (int i = 1; i < argc; i++) {
+        if (opened++) {
+            e_buffer_new();
+        }
+        if (!strcmp(argv[i], "-")) {
+            e_stream_open(STDIN_FILENO, NULL);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            int fd = open(argv[++i], O_RDONLY);
+            if (fd == -1) {
+                die("open");
+            }
+            e_stream_open(fd, argv[i]);
+        } else if (e_open(argv[i]) == -1) {
+            die("open");
+        }
     }
+    if (opened == 0 && E.tty != STDIN_FILENO) {
+        e_stream_open(STDIN_FILENO, NULL);
+    }
+    e_buffer_switch(0);
 
-    e_set_status_msg("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    if (E.statusmsg[0] == '\0') {
+        e_set_status_msg("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | "
+                         "Ctrl-Z/Y = undo/redo | Ctrl-O/N/P/W = open/next/prev/close");
+    }
 
     while (1) {
+        E.woken = 0;
         e_clear();
-        e_process_keypress();
+        if (E.journal_offer) {
+            e_journal_offer();
+        }
+        e_prof_frame();
+        e_input_wait(e_next_timeout());
+        if (E.resized) {
+            e_handle_resize();
+        }
+        e_prof_key();
+        while (e_input_pending()) {
+            long long t = e_prof_begin();
+            e_process_keypress();
+            e_prof_end(PROF_EDIT, t);
+        }
     }
 
     return 0;
 }
+#endif
 
 void enable_raw_mode() {
-    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) {
+    if (tcgetattr(E.tty, &E.orig_termios) == -1) {
         die("tcgetattr");
     }
     atexit(disable_raw_mode);
@@ -201,77 +882,263 @@ void enable_raw_mode() {
     raw.c_lflag &= ~(ECHO | IEXTEN | ICANON | ISIG);
 
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+    if (tcsetattr(E.tty, TCSAFLUSH, &raw) == -1) {
         die("tcsetattr");
     }
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
 void disable_raw_mode() {
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
+    if (tcsetattr(E.tty, TCSAFLUSH, &E.orig_termios) == -1) {
         die("tcsetattr");
     }
 }
 
 void die(const char *s) {
+    e_journal_flush_all();
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
     perror(s);
     exit(1);
 }
 
+static void e_on_signal(int sig) {
+    int saved = errno;
+    write(E.sig_pipe[1], sig == SIGWINCH ? "w" : "h", 1);
+    errno = saved;
+}
+
+void e_input_init() {
+    if (pipe2(E.sig_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        die("pipe2");
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = e_on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1 || sigaction(SIGHUP, &sa, NULL) == -1 ||
+        sigaction(SIGTERM, &sa, NULL) == -1) {
+        die("sigaction");
+    }
+}
+
+static int e_input_feed(int timeout) {
+    unsigned int room = PAGU_INPUT_BUF - (E.in.tail - E.in.head);
+    size_t n = E.feed.len < room ? E.feed.len : room;
+    if (n == 0 && timeout < 0) {
+        fprintf(stderr, "replay: a prompt is waiting for keys the script does not have\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        E.in.buf[E.in.tail++ % PAGU_INPUT_BUF] = E.feed.keys[i];
+    }
+    E.feed.keys += n;
+    E.feed.len -= n;
+    return n;
+}
+
+// blocks until input, a resize, worker results, stream data or the timeout
+int e_input_wait(int timeout) {
+    if (E.feed.on) {
+        return e_input_feed(timeout);
+    }
+    struct pollfd fds[3] = {
+        {E.tty, POLLIN, 0},
+        {E.sig_pipe[0], POLLIN, 0},
+        {-1, POLLIN, 0},
+    };
+    if (E.buf.stream.follow && E.buf.stream.fd != -1) {
+        if (E.buf.stream.pipe) {
+            fds[2].fd = E.buf.stream.fd;
+        } else if (E.buf.stream.more) {
+            timeout = 0;
+        } else if (timeout < 0 || timeout > PAGU_FOLLOW_MS) {
+            timeout = PAGU_FOLLOW_MS;
+        }
+    }
+    int due = e_journal_timeout();
+    if (due >= 0 && (timeout < 0 || timeout > due)) {
+        timeout = due;
+    }
+    long long t = e_prof_begin();
+    e_worker_release();
+    int r = poll(fds, 3, timeout);
+    e_worker_acquire();
+    e_prof_end(PROF_WAIT, t);
+    if (r == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        die("poll");
+    }
+    e_journal_tick();
+    if (E.buf.stream.follow && (fds[2].revents || !E.buf.stream.pipe) &&
+        e_stream_read()) {
+        E.woken = 1;
+    }
+    if (fds[1].revents & POLLIN) {
+        char drain[16];
+        ssize_t n;
+        while ((n = read(E.sig_pipe[0], drain, sizeof(drain))) > 0) {
+            if (memchr(drain, 'w', n)) {
+                E.resized = 1;
+            }
+            if (memchr(drain, 'h', n)) {
+                e_journal_flush_all();
+                exit(1);
+            }
+        }
+    }
+    if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+        return 0;
+    }
+
+    unsigned int used = E.in.tail - E.in.head;
+    unsigned int room = PAGU_INPUT_BUF - used;
+    if (room == 0) {
+        return 0;
+    }
+    unsigned int at = E.in.tail % PAGU_INPUT_BUF;
+    struct iovec iov[2];
+    iov[0].iov_base = &E.in.buf[at];
+    iov[0].iov_len = PAGU_INPUT_BUF - at < room ? PAGU_INPUT_BUF - at : room;
+    iov[1].iov_base = E.in.buf;
+    iov[1].iov_len = room - iov[0].iov_len;
+    ssize_t n = readv(E.tty, iov, iov[1].iov_len ? 2 : 1);
+    if (n == -1 && errno != EAGAIN && errno != EINTR) {
+        die("read");
+    }
+    if (n == 0) {
+        die("read");
+    }
+    if (n > 0) {
+        E.in.tail += n;
+    }
+    return n > 0 ? n : 0;
+}
+
+int e_input_pending() { return E.in.head != E.in.tail; }
+
+static int e_input_getc(int timeout) {
+    if (!e_input_pending()) {
+        e_input_wait(timeout);
+        if (!e_input_pending()) {
+            return -1;
+        }
+    }
+    return E.in.buf[E.in.head++ % PAGU_INPUT_BUF];
+}
+
+void e_handle_resize() {
+    E.resized = 0;
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        return;
+    }
+    E.screen_rows = ws.ws_row - 2;
+    E.screen_cols = ws.ws_col;
+    e_frame_resize();
+}
+
+int e_next_timeout() {
+    if (e_syntax_behind()) {
+        return 0;
+    }
+    if (E.statusmsg[0] == '\0') {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long ms = (E.statusmsg_time + 5 - now.tv_sec) * 1000L - now.tv_nsec / 1000000;
+    if (ms < 0) {
+        return -1;
+    }
+    return ms + 1;
+}
+
+static int e_decode_key();
+
 int e_read_key() {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) {
-            die("read");
+    long long t = e_prof_begin();
+    int c = e_decode_key();
+    e_prof_end(PROF_INPUT, t);
+    return c;
+}
+
+static int e_decode_key() {
+    int c;
+    while ((c = e_input_getc(-1)) == -1) {
+        if (E.resized) {
+            e_handle_resize();
+            e_clear();
+        }
+        if (E.woken) {
+            E.woken = 0;
+            return JOB_KEY;
         }
     }
     if (c == '\x1b') {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) {
+        int seq[2];
+        if ((seq[0] = e_input_getc(PAGU_ESC_TIMEOUT)) == -1) {
             return '\x1b';
         }
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) {
+        if ((seq[1] = e_input_getc(PAGU_ESC_TIMEOUT)) == -1) {
             return '\x1b';
         }
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return '\x1b';
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                    case '1':
-                    case '7':
+                int num = seq[1] - '0';
+                int params = 1;
+                int ch;
+                while ((ch = e_input_getc(PAGU_ESC_TIMEOUT)) != -1 &&
+                       ((ch >= '0' && ch <= '9') || ch == ';')) {
+                    if (ch == ';') {
+                        params++;
+                    } else if (params == 1) {
+                        num = num * 10 + ch - '0';
+                    }
+                }
+                if (ch == '~') {
+                    switch (num) {
+                    case 1:
+                    case 7:
                         return HOME_KEY;
-                    case '3':
+                    case 3:
                         return DEL_KEY;
-                    case '4':
-                    case '8':
+                    case 4:
+                    case 8:
                         return END_KEY;
-                    case '5':
+                    case 5:
                         return PAGE_UP;
-                    case '6':
+                    case 6:
                         return PAGE_DOWN;
+                    case 200:
+                        return e_read_paste();
                     }
+                } else if (ch != -1 && params > 1) {
+                    seq[1] = ch;
+                    goto csi_final;
                 }
-            } else {
-                switch (seq[1]) {
-                case 'A':
-                    return ARROW_UP;
-                case 'B':
-                    return ARROW_DOWN;
-                case 'C':
-                    return ARROW_RIGHT;
-                case 'D':
-                    return ARROW_LEFT;
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
-                }
+                return '\x1b';
+            }
+        csi_final:
+            switch (seq[1]) {
+            case 'A':
+                return ARROW_UP;
+            case 'B':
+                return ARROW_DOWN;
+            case 'C':
+                return ARROW_RIGHT;
+            case 'D':
+                return ARROW_LEFT;
+            case 'H':
+                return HOME_KEY;
+            case 'F':
+                return END_KEY;
             }
         } else if (seq[0] == 'O') {
             switch (seq[1]) {
@@ -287,6 +1154,29 @@ int e_read_key() {
     }
 }
 
+int e_read_paste() {
+    static const char end[] = "\x1b[201~";
+    int matched = 0;
+    int c;
+    E.paste.len = 0;
+    while ((c = e_input_getc(PAGU_PASTE_TIMEOUT)) != -1) {
+        if (E.paste.len == E.paste.cap) {
+            E.paste.cap = E.paste.cap ? E.paste.cap * 2 : 4096;
+            E.paste.b = realloc(E.paste.b, E.paste.cap);
+        }
+        E.paste.b[E.paste.len++] = c;
+        if (c == end[matched]) {
+            if (++matched == sizeof(end) - 1) {
+                E.paste.len -= matched;
+                break;
+            }
+        } else {
+            matched = (c == end[0]);
+        }
+    }
+    return PASTE_KEY;
+}
+
 int get_window_size(int *rows, int *cols) {
     struct winsize ws;
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
@@ -310,7 +1200,7 @@ int get_cursor_pos(int *rows, int *cols) {
     }
 
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+        if (read(E.tty, &buf[i], 1) != 1)
             break;
         if (buf[i] == 'R')
             break;
@@ -331,117 +1221,578 @@ int is_separator(int c) {
     return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-void e_update_syntax(e_row *row) {
-    row->hl = realloc(row->hl, row->r_size);
-    memset(row->hl, HL_NORMAL, row->r_size);
-
-    if (E.syntax == NULL) return;
-
-    char **keywords = E.syntax->keywords;
-
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+int e_syntax_compile(struct e_syntax *syn) {
+    if (syn->lex == NULL && e_lex_compile(syn) == -1) {
+        return -1;
+    }
+    return 0;
+}
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+// lexer states: 0 separator, 1 word, 2 number, then trie and rule states
+enum { LEX_SEP, LEX_WORD, LEX_NUM };
 
-    int prev_sep = 1;
-    int in_string = 0;
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+struct e_lex_node {
+    int child, sibling, parent;
+    unsigned char c;
+    unsigned char depth;
+    unsigned char accept; // keyword: its hl; delimiter: 1 + its rule
+    unsigned char dl;
+    int state;            // -1 for delimiters that complete at once
+};
 
-    int i = 0;
-    while (i < row->r_size) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+struct e_lex_build {
+    struct e_syntax *syn;
+    struct e_lex *lx;
+    struct e_lex_node *nodes;
+    int n_nodes;
+    int kw_root, dl_root;
+    unsigned char sep[256];
+    unsigned char rep[256];
+    int *rule_state;
+    int *state_node;
+    struct e_lex_move *moves;
+};
 
-        if (scs_len && !in_string && !in_comment) {
-            if (!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->r_size - i);
-                break;
-            }
-        }
+static struct e_lex_move e_lex_mv(int next, int hl, int back, int back_hl) {
+    return (struct e_lex_move){next, hl | back_hl << 4, back};
+}
 
-        if (mcs_len && mce_len && !in_string) {
-            if (in_comment) {
-                row->hl[i] = HL_MLCOMMENT;
-                if (!strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                } else {
-                    i++;
-                    continue;
-                }
-            } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
+static int e_lex_child(struct e_lex_build *b, int node, int c) {
+    for (int k = b->nodes[node].child; k != -1; k = b->nodes[k].sibling) {
+        if (b->nodes[k].c == c) {
+            return k;
         }
+    }
+    return -1;
+}
 
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            if (in_string) {
-                row->hl[i] = HL_STRING;
-                if (c == '\\' && i + 1 < row->r_size) {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-                if (c == in_string) in_string = 0;
-                i++;
-                prev_sep = 1;
-                continue;
-            } else {
-                if (c == '"' || c == '\'') {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
+static int e_lex_insert(struct e_lex_build *b, int node, const char *s) {
+    for (; *s; s++) {
+        int k = e_lex_child(b, node, (unsigned char)*s);
+        if (k == -1) {
+            k = b->n_nodes++;
+            b->nodes = realloc(b->nodes, sizeof(struct e_lex_node) * b->n_nodes);
+            b->nodes[k] = (struct e_lex_node){-1, b->nodes[node].child, node, (unsigned char)*s,
+                                              b->nodes[node].depth + 1, 0, b->nodes[node].dl, -1};
+            b->nodes[node].child = k;
         }
+        node = k;
+    }
+    return node;
+}
 
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-                (c == '.' && prev_hl == HL_NUMBER)) {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
-                continue;
-            }
+static struct e_lex_move e_lex_normal(struct e_lex_build *b, int from, int c) {
+    int node = b->state_node[from];
+    int back = 0, back_hl = 0;
+    if (node != -1 && b->nodes[node].accept && b->sep[c]) {
+        back = b->nodes[node].depth;
+        back_hl = b->nodes[node].accept;
+    }
+    int d = e_lex_child(b, b->dl_root, c);
+    if (d != -1) {
+        if (b->nodes[d].child == -1) {
+            struct e_lex_rule *r = &b->syn->rules[b->nodes[d].accept - 1];
+            return e_lex_mv(b->rule_state[b->nodes[d].accept - 1], r->hl, back, back_hl);
         }
-
-        if (prev_sep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-                if (kw2) klen--;
-                if (!strncmp(&row->render[i], keywords[j], klen) && is_separator(row->render[i + klen])) {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL) {
-                prev_sep = 0;
-                continue;
-            }
+        return e_lex_mv(b->nodes[d].state, HL_NORMAL, back, back_hl);
+    }
+    if (b->syn->flags & HL_HIGHLIGHT_NUMBERS) {
+        if ((from == LEX_SEP && isdigit(c)) ||
+            (from == LEX_NUM && (isdigit(c) || c == '.'))) {
+            return e_lex_mv(LEX_NUM, HL_NUMBER, 0, 0);
         }
-
-        prev_sep = is_separator(c);
-        i++;
     }
-
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < E.n_rows) e_update_syntax(&E.row[row->idx + 1]);
-
+    if (!b->sep[c]) {
+        int k = from == LEX_SEP ? e_lex_child(b, b->kw_root, c)
+                : node != -1    ? e_lex_child(b, node, c)
+                                : -1;
+        return e_lex_mv(k != -1 ? b->nodes[k].state : LEX_WORD, HL_NORMAL, 0, 0);
+    }
+    return e_lex_mv(LEX_SEP, HL_NORMAL, back, back_hl);
+}
+
+static struct e_lex_move e_lex_inside(struct e_lex_build *b, int r, int j, int c) {
+    struct e_lex_rule *rule = &b->syn->rules[r];
+    int base = b->rule_state[r];
+    if (rule->close == NULL || j == -1) {
+        return e_lex_mv(base, rule->hl, 0, 0);
+    }
+    if (rule->escape && c == rule->escape) {
+        return e_lex_mv(base + strlen(rule->close), rule->hl, 0, 0);
+    }
+    char seen[256];
+    memcpy(seen, rule->close, j);
+    seen[j] = c;
+    int k = j + 1;
+    while (k > 0 && memcmp(seen + j + 1 - k, rule->close, k)) {
+        k--;
+    }
+    if (rule->close[k] == '\0') {
+        return e_lex_mv(LEX_SEP, rule->hl, 0, 0);
+    }
+    return e_lex_mv(base + k, rule->hl, 0, 0);
+}
+
+// re-runs a delimiter prefix that left the trie
+static struct e_lex_move e_lex_resolve(struct e_lex_build *b, int node, int c) {
+    int d = b->nodes[node].depth;
+    unsigned char path[256], col[256];
+    int rule = -1, at = 0;
+    for (int k = node; k != b->dl_root; k = b->nodes[k].parent) {
+        path[b->nodes[k].depth - 1] = b->nodes[k].c;
+        if (rule == -1 && b->nodes[k].accept) {
+            rule = b->nodes[k].accept - 1;
+            at = b->nodes[k].depth;
+        }
+    }
+    int st;
+    if (rule != -1) {
+        memset(col, b->syn->rules[rule].hl, at);
+        st = b->rule_state[rule];
+    } else {
+        col[0] = HL_NORMAL;
+        st = b->sep[path[0]] ? LEX_SEP : LEX_WORD;
+        at = 1;
+    }
+    int n = d + (c != -1);
+    for (int k = at; k < n; k++) {
+        struct e_lex_move m = b->moves[st * b->lx->n_cls + b->lx->cls[k < d ? path[k] : c]];
+        col[k] = m.hl & 0xf;
+        memset(col + k - m.back, m.hl >> 4, m.back);
+        st = m.next;
+    }
+    int keep = 0;
+    if (c == -1) {
+        struct e_lex_move m = b->lx->eol[st];
+        memset(col + d - m.back, m.hl >> 4, m.back);
+        st = m.next;
+    } else if (b->state_node[st] != -1 && b->nodes[b->state_node[st]].dl) {
+        keep = b->nodes[b->state_node[st]].depth - 1;
+    }
+    int back = d - keep;
+    int plain = 1;
+    for (int k = 0; k < back; k++) {
+        plain &= col[k] == HL_NORMAL;
+    }
+    return e_lex_mv(st, c == -1 ? 0 : col[d], plain ? 0 : back, plain ? 0 : col[0]);
+}
+
+int e_lex_compile(struct e_syntax *syn) {
+    struct e_lex_build b = {0};
+    b.syn = syn;
+    if (syn->rules == NULL) {
+        syn->rules = calloc(4, sizeof(struct e_lex_rule));
+        if (syn->singleline_comment_start) {
+            syn->rules[syn->n_rules++] =
+                (struct e_lex_rule){syn->singleline_comment_start, NULL, HL_COMMENT, 0, 0};
+        }
+        if (syn->multiline_comment_start && syn->multiline_comment_end) {
+            syn->rules[syn->n_rules++] = (struct e_lex_rule){
+                syn->multiline_comment_start, syn->multiline_comment_end, HL_MLCOMMENT, 1, 0};
+        }
+        if (syn->flags & HL_HIGHLIGHT_STRINGS) {
+            syn->rules[syn->n_rules++] = (struct e_lex_rule){"\"", "\"", HL_STRING, 0, '\\'};
+            syn->rules[syn->n_rules++] = (struct e_lex_rule){"'", "'", HL_STRING, 0, '\\'};
+        }
+    }
+    const char *seps = syn->separators ? syn->separators : ",.()+-/*=~%<>[];";
+    for (int c = 0; c < 256; c++) {
+        b.sep[c] = isspace(c) || c == '\0' || (c && strchr(seps, c));
+    }
+
+    b.nodes = malloc(sizeof(struct e_lex_node) * 2);
+    b.nodes[0] = (struct e_lex_node){-1, -1, -1, 0, 0, 0, 0, LEX_SEP};
+    b.nodes[1] = (struct e_lex_node){-1, -1, -1, 0, 0, 0, 1, -1};
+    b.kw_root = 0;
+    b.dl_root = 1;
+    b.n_nodes = 2;
+    for (int j = 0; syn->keywords && syn->keywords[j]; j++) {
+        char word[256];
+        int n = strlen(syn->keywords[j]);
+        int kw2 = n && syn->keywords[j][n - 1] == '|';
+        n -= kw2;
+        if (n == 0 || n >= (int)sizeof(word) || isdigit((unsigned char)syn->keywords[j][0])) {
+            continue;
+        }
+        memcpy(word, syn->keywords[j], n);
+        word[n] = '\0';
+        int k = 0;
+        while (k < n && !b.sep[(unsigned char)word[k]]) k++;
+        if (k < n) {
+            continue;
+        }
+        int node = e_lex_insert(&b, b.kw_root, word);
+        if (!b.nodes[node].accept) {
+            b.nodes[node].accept = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+        }
+    }
+    // backwards, so of two rules that open alike the first wins
+    for (int r = syn->n_rules - 1; r >= 0; r--) {
+        if (syn->rules[r].open[0] && strlen(syn->rules[r].open) < 256 &&
+            (syn->rules[r].close == NULL || strlen(syn->rules[r].close) < 256)) {
+            int node = e_lex_insert(&b, b.dl_root, syn->rules[r].open);
+            b.nodes[node].accept = r + 1;
+        }
+    }
+
+    struct e_lex *lx = calloc(1, sizeof(struct e_lex));
+    b.lx = lx;
+    int key_cls[256 + 4];
+    memset(key_cls, -1, sizeof(key_cls));
+    unsigned char special[256] = {0};
+    for (int k = 2; k < b.n_nodes; k++) {
+        special[b.nodes[k].c] = 1;
+    }
+    for (int r = 0; r < syn->n_rules; r++) {
+        for (const char *p = syn->rules[r].close; p && *p; p++) {
+            special[(unsigned char)*p] = 1;
+        }
+        special[syn->rules[r].escape] = 1;
+    }
+    special['.'] = 1;
+    for (int c = 0; c < 256; c++) {
+        int key = special[c] ? c : 256 + b.sep[c] + 2 * !!isdigit(c);
+        if (key_cls[key] == -1) {
+            b.rep[lx->n_cls] = c;
+            key_cls[key] = lx->n_cls++;
+        }
+        lx->cls[c] = key_cls[key];
+    }
+
+    // prefixes shortest first so their moves can reuse shorter ones
+    lx->n_states = 3;
+    int max_depth = 0;
+    for (int k = 2; k < b.n_nodes; k++) {
+        if (!b.nodes[k].dl) {
+            b.nodes[k].state = lx->n_states++;
+        } else if (b.nodes[k].depth > max_depth) {
+            max_depth = b.nodes[k].depth;
+        }
+    }
+    int first_open = lx->n_states;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        for (int k = 2; k < b.n_nodes; k++) {
+            if (b.nodes[k].dl && b.nodes[k].depth == depth && b.nodes[k].child != -1) {
+                b.nodes[k].state = lx->n_states++;
+            }
+        }
+    }
+    int first_rule = lx->n_states;
+    b.rule_state = malloc(sizeof(int) * (syn->n_rules + 1));
+    for (int r = 0; r < syn->n_rules; r++) {
+        b.rule_state[r] = lx->n_states;
+        lx->n_states += syn->rules[r].close
+                            ? (int)strlen(syn->rules[r].close) + !!syn->rules[r].escape
+                            : 1;
+    }
+    if ((long)lx->n_states * lx->n_cls > 65535) {
+        free(b.nodes);
+        free(b.rule_state);
+        free(lx);
+        return -1;
+    }
+    b.state_node = malloc(sizeof(int) * lx->n_states);
+    for (int i = 0; i < lx->n_states; i++) {
+        b.state_node[i] = -1;
+    }
+    for (int k = 2; k < b.n_nodes; k++) {
+        if (b.nodes[k].state != -1) {
+            b.state_node[b.nodes[k].state] = k;
+        }
+    }
+    lx->moves = malloc(sizeof(struct e_lex_move) * lx->n_states * lx->n_cls);
+    lx->eol = malloc(sizeof(struct e_lex_move) * lx->n_states);
+    b.moves = lx->moves;
+
+    for (int i = 0; i < lx->n_states; i++) {
+        int st = i < first_open ? i
+                 : i < first_open + lx->n_states - first_rule ? i - first_open + first_rule
+                                                              : i - (lx->n_states - first_rule);
+        struct e_lex_move *row = &lx->moves[st * lx->n_cls];
+        int node = b.state_node[st];
+        if (st < first_open) {
+            for (int k = 0; k < lx->n_cls; k++) {
+                row[k] = e_lex_normal(&b, st, b.rep[k]);
+            }
+            lx->eol[st] = node != -1 && b.nodes[node].accept
+                              ? e_lex_mv(LEX_SEP, 0, b.nodes[node].depth, b.nodes[node].accept)
+                              : e_lex_mv(LEX_SEP, 0, 0, 0);
+        } else if (st < first_rule) {
+            int depth = b.nodes[node].depth;
+            for (int k = 0; k < lx->n_cls; k++) {
+                int d = e_lex_child(&b, node, b.rep[k]);
+                if (d == -1) {
+                    row[k] = e_lex_resolve(&b, node, b.rep[k]);
+                } else if (b.nodes[d].child == -1) {
+                    int hl = syn->rules[b.nodes[d].accept - 1].hl;
+                    row[k] = e_lex_mv(b.rule_state[b.nodes[d].accept - 1], hl, depth, hl);
+                } else {
+                    row[k] = e_lex_mv(b.nodes[d].state, HL_NORMAL, 0, 0);
+                }
+            }
+            lx->eol[st] = e_lex_resolve(&b, node, -1);
+        } else {
+            int r = syn->n_rules - 1;
+            while (b.rule_state[r] > st) r--;
+            struct e_lex_rule *rule = &syn->rules[r];
+            int j = st - b.rule_state[r];
+            if (rule->close && j == (int)strlen(rule->close)) {
+                j = -1;
+            }
+            for (int k = 0; k < lx->n_cls; k++) {
+                row[k] = e_lex_inside(&b, r, j, b.rep[k]);
+            }
+            lx->eol[st] = e_lex_mv(rule->close && rule->multiline ? b.rule_state[r] : LEX_SEP,
+                                   0, 0, 0);
+            if (rule->multiline && rule->close && rule->hl == HL_MLCOMMENT && !lx->block) {
+                lx->block = rule;
+                lx->block_state = b.rule_state[r];
+            }
+        }
+    }
+    for (int i = 0; i < lx->n_states * lx->n_cls; i++) {
+        lx->moves[i].next *= lx->n_cls;
+    }
+    free(b.nodes);
+    free(b.rule_state);
+    free(b.state_node);
+    syn->lex = lx;
+    return 0;
+}
+
+int e_syntax_scan(const char *s, int len, unsigned char *hl, int state) {
+    const struct e_lex *lx = E.buf.syntax->lex;
+    const struct e_lex_move *moves = lx->moves;
+    unsigned int st = state * lx->n_cls;
+    for (int i = 0; i < len; i++) {
+        struct e_lex_move m = moves[st + lx->cls[(unsigned char)s[i]]];
+        hl[i] = m.hl & 0xf;
+        if (m.back) {
+            memset(&hl[i - m.back], m.hl >> 4, m.back);
+        }
+        st = m.next;
+    }
+    struct e_lex_move m = lx->eol[st / lx->n_cls];
+    if (m.back) {
+        memset(&hl[len - m.back], m.hl >> 4, m.back);
+    }
+    return m.next;
+}
+
+// a slice from the middle of a row: no eol move, and recoloring stops at hl[0]
+int e_syntax_run(const char *s, int len, unsigned char *hl, int state) {
+    const struct e_lex *lx = E.buf.syntax->lex;
+    unsigned int st = state * lx->n_cls;
+    for (int i = 0; i < len; i++) {
+        struct e_lex_move m = lx->moves[st + lx->cls[(unsigned char)s[i]]];
+        hl[i] = m.hl & 0xf;
+        if (m.back) {
+            int back = m.back < i ? m.back : i;
+            memset(&hl[i - back], m.hl >> 4, back);
+        }
+        st = m.next;
+    }
+    return st / lx->n_cls;
+}
+
+static unsigned char *e_syntax_scratch(int len) {
+    static unsigned char *scratch = NULL;
+    static int cap = 0;
+    if (len > cap) {
+        cap = len * 2;
+        scratch = realloc(scratch, cap);
+        E.stats.allocs++;
+    }
+    return scratch;
+}
+
+static int e_row_hl_len(e_row *row) {
+    return (row->flags & ROW_CHUNKED) ? row->segs->hl_len : row->size;
+}
+
+// a long row's checkpoint from its last comment delimiter
+static int e_syntax_long_row(e_row *row, int in_state) {
+    static char buf[PAGU_SEG + 16];
+    struct e_lex *lx = E.buf.syntax->lex;
+    if (lx->block == NULL) {
+        return 0;
+    }
+    const char *ms = lx->block->open;
+    const char *me = lx->block->close;
+    int ls = strlen(ms), le = strlen(me);
+    for (int end = row->size; end > 0;) {
+        int at = end > PAGU_SEG ? end - PAGU_SEG : 0;
+        int n = row->size - at < end - at + 16 ? row->size - at : end - at + 16;
+        e_row_copy(row, at, n, buf);
+        for (int i = end - at - 1; i >= 0; i--) {
+            if (i + le <= n && !memcmp(&buf[i], me, le)) {
+                return 0;
+            }
+            if (i + ls <= n && !memcmp(&buf[i], ms, ls)) {
+                return lx->block_state;
+            }
+        }
+        end = at;
+    }
+    return in_state;
+}
+
+static int e_seg_find(struct e_segs *, int *);
+
+// rescans segments from hl_from up to segment `to`, skipping ahead
+// whenever an entry state comes out as it was
+static void e_seg_sync(e_row *row, int in_state, int to) {
+    struct e_segs *g = row->segs;
+    if (g->seg[0]->hl_in != in_state) {
+        g->seg[0]->hl_in = in_state;
+        g->hl_from = 0;
+    }
+    while (g->hl_from < to) {
+        int i = g->hl_from;
+        struct e_seg *seg = g->seg[i];
+        int st = e_syntax_run(seg->data, seg->len, e_syntax_scratch(seg->len), seg->hl_in);
+        if (i + 1 == g->n) {
+            g->hl_end = st;
+            g->hl_from = g->n;
+        } else if (g->seg[i + 1]->hl_in != st) {
+            g->seg[i + 1]->hl_in = st;
+            g->hl_from = i + 1;
+        } else {
+            int k = i + 2;
+            while (k < g->n && g->seg[k]->hl_in != -1) k++;
+            g->hl_from = k < g->n ? k - 1 : g->n;
+        }
+    }
+}
+
+static int e_syntax_row(e_row *row, int in_state) {
+    if ((row->flags & ROW_CHUNKED) && row->hl &&
+        row->segs->hl_at + row->segs->hl_len > row->size) {
+        e_cache_evict(row);
+    }
+    if (row->hl == NULL && (row->flags & ROW_CHUNKED)) {
+        struct e_segs *g = row->segs;
+        if (g->hl_end == -1) {
+            return e_syntax_long_row(row, in_state);
+        }
+        e_seg_sync(row, in_state, g->n);
+        return E.buf.syntax->lex->eol[g->hl_end].next;
+    }
+    if (row->hl == NULL && row->size > PAGU_LONG_ROW) {
+        return e_syntax_long_row(row, in_state);
+    }
+    if (row->flags & ROW_CHUNKED) {
+        struct e_segs *g = row->segs;
+        const struct e_lex *lx = E.buf.syntax->lex;
+        // edits inside hl leave the state at its start alone, and the
+        // rest of the row too if the state at its end comes out the same
+        int same = g->hl_win_in != -1 && g->hl_end != -1 && g->seg[0]->hl_in == in_state;
+        if (!same) {
+            int at = g->hl_at;
+            int k = e_seg_find(g, &at);
+            e_seg_sync(row, in_state, k);
+            g->hl_win_in = e_syntax_run(g->seg[k]->data, at, e_syntax_scratch(at),
+                                        g->seg[k]->hl_in);
+        }
+        char *text = (char *)e_syntax_scratch(g->hl_len);
+        e_row_copy(row, g->hl_at, g->hl_len, text);
+        int st = e_syntax_run(text, g->hl_len, row->hl, g->hl_win_in);
+        if (g->hl_at + g->hl_len == row->size) {
+            struct e_lex_move m = lx->eol[st];
+            int back = m.back < g->hl_len ? m.back : g->hl_len;
+            memset(&row->hl[g->hl_len - back], m.hl >> 4, back);
+        }
+        row->flags |= ROW_DAMAGED;
+        E.hl_redraw = 1;
+        if (!same || st != g->hl_win_out) {
+            g->hl_win_out = st;
+            e_seg_sync(row, in_state, g->n);
+        }
+        return lx->eol[g->hl_end].next;
+    }
+    if (row->hl) {
+        row->flags |= ROW_DAMAGED;
+        E.hl_redraw = 1;
+        return e_syntax_scan(row->chars, row->size, row->hl, in_state);
+    }
+    return e_syntax_scan(row->chars, row->size, e_syntax_scratch(row->size),
+                         in_state);
+}
+
+void e_syntax_sync(int at) {
+    if (E.buf.syntax == NULL || E.buf.hl_frontier >= at) {
+        return;
+    }
+    e_row *row = e_row_at(E.buf.hl_frontier);
+    e_row *prev = row ? e_row_prev(row) : NULL;
+    int in_state = prev ? prev->hl_state : 0;
+    while (row && E.buf.hl_frontier < at) {
+        in_state = e_syntax_row(row, in_state);
+        row->hl_state = in_state;
+        E.buf.hl_frontier++;
+        row = e_row_next(row);
+    }
+}
+
+// without the worker, the frontier gains PAGU_SYNC_ROWS a frame until it
+// reaches the viewport
+int e_syntax_behind() {
+    int to = E.buf.row_off + E.screen_rows;
+    return E.buf.syntax && !E.worker.running &&
+           E.buf.hl_frontier < (to < E.buf.n_rows ? to : E.buf.n_rows);
+}
+
+// rehighlights from row until a checkpoint comes out unchanged
+void e_syntax_cascade(e_row *row, int in_state) {
+    if (E.buf.syntax == NULL || row == NULL) {
+        return;
+    }
+    int at = e_row_idx(row);
+    while (row && at < E.buf.hl_frontier) {
+        int out = e_syntax_row(row, in_state);
+        if (out == row->hl_state) {
+            break;
+        }
+        row->hl_state = out;
+        in_state = out;
+        row = e_row_next(row);
+        at++;
+    }
+}
+
+static void e_syntax_update(e_row *row);
+
+void e_update_syntax(e_row *row) {
+    long long t = e_prof_begin();
+    e_syntax_update(row);
+    e_prof_end(PROF_HL, t);
+}
+
+static void e_syntax_update(e_row *row) {
+    if (E.buf.syntax == NULL) {
+        memset(row->hl, HL_NORMAL, e_row_hl_len(row));
+        row->flags |= ROW_DAMAGED;
+        return;
+    }
+    int at = e_row_idx(row);
+    e_row *prev = e_row_prev(row);
+    // far past the frontier: provisional until the sync gets here
+    if (at - E.buf.hl_frontier > PAGU_SYNC_ROWS) {
+        row->hl_state = e_syntax_row(row, prev ? prev->hl_state : 0);
+        return;
+    }
+    e_syntax_sync(at);
+    int in_state = prev ? prev->hl_state : 0;
+    if (at == E.buf.hl_frontier) {
+        row->hl_state = e_syntax_row(row, in_state);
+        E.buf.hl_frontier++;
+        return;
+    }
+    int out = e_syntax_row(row, in_state);
+    if (out != row->hl_state) {
+        row->hl_state = out;
+        e_syntax_cascade(e_row_next(row), out);
+    }
 }
 
 int e_syntax_to_color(int hl) {
@@ -457,361 +1808,3790 @@ int e_syntax_to_color(int hl) {
     }
 }
 
-void e_select_hl() {
-    E.syntax = NULL;
-    if (E.filename == NULL)
-        return;
-    char *ext = strrchr(E.filename, '.');
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct e_syntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(E.filename, s->filematch[i]))) {
-                E.syntax = s;
-                int filerow;
-                for (filerow = 0; filerow < E.n_rows; filerow++) {
-                    e_update_syntax(&E.row[filerow]);
-                }
-                return;
+void e_syntax_reset() {
+    E.buf.hl_frontier = 0;
+    for (e_row *row = e_row_at(0); row; row = e_row_next(row)) {
+        e_cache_evict(row);
+        row->hl_state = 0;
+    }
+}
+
+static void e_syntax_free(struct e_syntax *syn) {
+    for (int j = 0; syn->filematch && syn->filematch[j]; j++) {
+        free(syn->filematch[j]);
+    }
+    for (int j = 0; syn->keywords && syn->keywords[j]; j++) {
+        free(syn->keywords[j]);
+    }
+    for (int j = 0; j < syn->n_rules; j++) {
+        free(syn->rules[j].open);
+        free(syn->rules[j].close);
+    }
+    free(syn->filematch);
+    free(syn->keywords);
+    free(syn->rules);
+    free(syn->separators);
+    free(syn->filetype);
+    free(syn);
+}
+
+static char *e_syntax_word(char **line) {
+    char *w = *line + strspn(*line, " \t");
+    if (*w == '\0') {
+        return NULL;
+    }
+    char *end = w + strcspn(w, " \t");
+    *line = *end ? end + 1 : end;
+    *end = '\0';
+    return w;
+}
+
+// a syntax definition: one directive per line, # starts a comment line
+//   filetype NAME                     match .EXT|NAME ...
+//   comment OPEN                      block OPEN CLOSE
+//   string OPEN CLOSE [multiline] [raw]
+//   keywords WORD ...                 types WORD ...
+//   numbers                           separators CHARS
+// whitespace always separates words
+static struct e_syntax *e_syntax_parse(FILE *fp, const char **error, int *lineno) {
+    struct e_syntax *syn = calloc(1, sizeof(struct e_syntax));
+    int n_match = 0, n_kw = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    *error = NULL;
+    *lineno = 0;
+    while (*error == NULL && (len = getline(&line, &cap, fp)) != -1) {
+        ++*lineno;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *rest = line;
+        char *dir = e_syntax_word(&rest);
+        if (dir == NULL || *dir == '#') {
+            continue;
+        }
+        if (!strcmp(dir, "filetype")) {
+            char *name = e_syntax_word(&rest);
+            if (name == NULL) {
+                *error = "filetype needs a name";
+            } else {
+                free(syn->filetype);
+                syn->filetype = strdup(name);
+            }
+        } else if (!strcmp(dir, "match") || !strcmp(dir, "keywords") || !strcmp(dir, "types")) {
+            int kw = dir[0] != 'm';
+            for (char *w; (w = e_syntax_word(&rest));) {
+                char ***list = kw ? &syn->keywords : &syn->filematch;
+                int *n = kw ? &n_kw : &n_match;
+                *list = realloc(*list, sizeof(char *) * (*n + 2));
+                (*list)[*n] = malloc(strlen(w) + 2);
+                sprintf((*list)[*n], "%s%s", w, dir[0] == 't' ? "|" : "");
+                (*list)[++*n] = NULL;
+            }
+        } else if (!strcmp(dir, "comment") || !strcmp(dir, "block") || !strcmp(dir, "string")) {
+            char *open = e_syntax_word(&rest);
+            char *close = dir[0] == 'c' ? NULL : e_syntax_word(&rest);
+            if (open == NULL || (dir[0] != 'c' && close == NULL)) {
+                *error = "missing delimiter";
+                break;
+            }
+            struct e_lex_rule r = {strdup(open), close ? strdup(close) : NULL,
+                                   dir[0] == 'c' ? HL_COMMENT : dir[0] == 'b' ? HL_MLCOMMENT : HL_STRING,
+                                   dir[0] == 'b', dir[0] == 's' ? '\\' : 0};
+            for (char *w; (w = e_syntax_word(&rest));) {
+                if (!strcmp(w, "multiline")) {
+                    r.multiline = 1;
+                } else if (!strcmp(w, "raw")) {
+                    r.escape = 0;
+                } else {
+                    *error = "unknown option";
+                }
+            }
+            if (*error) {
+                free(r.open);
+                free(r.close);
+                break;
+            }
+            syn->rules = realloc(syn->rules, sizeof(struct e_lex_rule) * (syn->n_rules + 1));
+            syn->rules[syn->n_rules++] = r;
+        } else if (!strcmp(dir, "numbers")) {
+            syn->flags |= HL_HIGHLIGHT_NUMBERS;
+        } else if (!strcmp(dir, "separators")) {
+            free(syn->separators);
+            syn->separators = malloc(strlen(rest) + 1);
+            int n = 0;
+            for (char *c = rest; *c; c++) {
+                if (*c != ' ' && *c != '\t') syn->separators[n++] = *c;
+            }
+            syn->separators[n] = '\0';
+        } else {
+            *error = "unknown directive";
+        }
+    }
+    free(line);
+    if (*error == NULL && (syn->filetype == NULL || n_match == 0)) {
+        *error = "needs a filetype and a match";
+        *lineno = 0;
+    }
+    if (*error == NULL && syn->rules == NULL) {
+        syn->rules = calloc(1, sizeof(struct e_lex_rule));
+    }
+    if (*error == NULL && syn->keywords == NULL) {
+        syn->keywords = calloc(1, sizeof(char *));
+    }
+    if (*error == NULL) {
+        return syn;
+    }
+    e_syntax_free(syn);
+    return NULL;
+}
+
+static void e_syntax_load_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+    for (struct dirent *ent; (ent = readdir(d));) {
+        size_t n = strlen(ent->d_name);
+        if (n < 5 || strcmp(ent->d_name + n - 4, ".syn")) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+            continue;
+        }
+        const char *error;
+        int lineno;
+        struct e_syntax *syn = e_syntax_parse(fp, &error, &lineno);
+        fclose(fp);
+        if (syn == NULL) {
+            e_set_status_msg("%s:%d: %s", path, lineno, error);
+            continue;
+        }
+        int k = 0;
+        while (k < HLDB_n_files && strcmp(HLDB_files[k]->filetype, syn->filetype)) k++;
+        if (k < HLDB_n_files) {
+            e_syntax_free(syn);
+            continue;
+        }
+        HLDB_files = realloc(HLDB_files, sizeof(struct e_syntax *) * (HLDB_n_files + 1));
+        HLDB_files[HLDB_n_files++] = syn;
+    }
+    closedir(d);
+}
+
+// reads syntax/*.syn from $PAGU_SYNTAX, the config dir and the binary's dir
+void e_syntax_load() {
+    static int loaded;
+    if (loaded++) {
+        return;
+    }
+    char dir[PATH_MAX];
+    char *env = getenv("PAGU_SYNTAX");
+    if (env && *env) {
+        e_syntax_load_dir(env);
+    }
+    char *config = getenv("XDG_CONFIG_HOME");
+    char *home = getenv("HOME");
+    if (config && *config) {
+        snprintf(dir, sizeof(dir), "%s/pagu/syntax", config);
+        e_syntax_load_dir(dir);
+    } else if (home && *home) {
+        snprintf(dir, sizeof(dir), "%s/.config/pagu/syntax", home);
+        e_syntax_load_dir(dir);
+    }
+    ssize_t n = readlink("/proc/self/exe", dir, sizeof(dir) - 8);
+    if (n > 0) {
+        dir[n] = '\0';
+        char *slash = strrchr(dir, '/');
+        strcpy(slash ? slash + 1 : dir, "syntax");
+        e_syntax_load_dir(dir);
+    }
+}
+
+static int e_syntax_matches(struct e_syntax *s, const char *filename) {
+    char *ext = strrchr(filename, '.');
+    for (unsigned int i = 0; s->filematch[i]; i++) {
+        int is_ext = (s->filematch[i][0] == '.');
+        if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+            (!is_ext && strstr(filename, s->filematch[i]))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void e_select_hl() {
+    E.buf.syntax = NULL;
+    e_syntax_reset();
+    if (E.buf.filename == NULL)
+        return;
+    for (unsigned int j = 0; j < HLDB_n_files + HLDB_ENTRIES; j++) {
+        struct e_syntax *s = j < (unsigned int)HLDB_n_files ? HLDB_files[j] : &HLDB[j - HLDB_n_files];
+        if (e_syntax_matches(s, E.buf.filename)) {
+            if (e_syntax_compile(s) == -1) {
+                e_set_status_msg("%s: too many keywords to compile", s->filetype);
+                return;
+            }
+            E.buf.syntax = s;
+            e_syntax_reset();
+            return;
+        }
+    }
+}
+
+// row store
+static uint32_t rt_rand(void) {
+    static uint32_t x = 2463534242u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static int rt_count(e_row *n) { return n ? n->count : 0; }
+
+static void rt_pull(e_row *n) {
+    n->count = 1 + rt_count(n->left) + rt_count(n->right);
+}
+
+static void rt_rotate_up(e_row *x) {
+    e_row *p = x->parent;
+    e_row *g = p->parent;
+    if (p->left == x) {
+        p->left = x->right;
+        if (x->right) x->right->parent = p;
+        x->right = p;
+    } else {
+        p->right = x->left;
+        if (x->left) x->left->parent = p;
+        x->left = p;
+    }
+    p->parent = x;
+    x->parent = g;
+    if (g == NULL) {
+        E.buf.rows = x;
+    } else if (g->left == p) {
+        g->left = x;
+    } else {
+        g->right = x;
+    }
+    rt_pull(p);
+    rt_pull(x);
+}
+
+e_row *e_row_at(int at) {
+    e_row *n = E.buf.rows;
+    if (at < 0 || at >= rt_count(n)) {
+        return NULL;
+    }
+    while (n) {
+        int l = rt_count(n->left);
+        if (at < l) {
+            n = n->left;
+        } else if (at == l) {
+            return n;
+        } else {
+            at -= l + 1;
+            n = n->right;
+        }
+    }
+    return NULL;
+}
+
+int e_row_idx(e_row *row) {
+    int idx = rt_count(row->left);
+    for (e_row *n = row; n->parent; n = n->parent) {
+        if (n->parent->right == n) {
+            idx += rt_count(n->parent->left) + 1;
+        }
+    }
+    return idx;
+}
+
+e_row *e_row_next(e_row *row) {
+    if (row->right) {
+        row = row->right;
+        while (row->left) row = row->left;
+        return row;
+    }
+    while (row->parent && row->parent->right == row) row = row->parent;
+    return row->parent;
+}
+
+e_row *e_row_prev(e_row *row) {
+    if (row->left) {
+        row = row->left;
+        while (row->right) row = row->right;
+        return row;
+    }
+    while (row->parent && row->parent->left == row) row = row->parent;
+    return row->parent;
+}
+
+void rt_link(int at, e_row *row) {
+    row->left = row->right = NULL;
+    row->count = 1;
+    row->prio = rt_rand();
+
+    e_row *p = E.buf.rows;
+    if (p == NULL) {
+        row->parent = NULL;
+        E.buf.rows = row;
+        return;
+    }
+    if (at >= p->count) {
+        while (p->right) p = p->right;
+        p->right = row;
+    } else {
+        p = e_row_at(at);
+        if (p->left) {
+            p = p->left;
+            while (p->right) p = p->right;
+            p->right = row;
+        } else {
+            p->left = row;
+        }
+    }
+    row->parent = p;
+    for (e_row *n = p; n; n = n->parent) n->count++;
+    while (row->parent && row->parent->prio < row->prio) {
+        rt_rotate_up(row);
+    }
+}
+
+void rt_unlink(e_row *row) {
+    while (row->left || row->right) {
+        e_row *c;
+        if (row->left == NULL) {
+            c = row->right;
+        } else if (row->right == NULL) {
+            c = row->left;
+        } else {
+            c = row->left->prio > row->right->prio ? row->left : row->right;
+        }
+        rt_rotate_up(c);
+    }
+    e_row *p = row->parent;
+    if (p == NULL) {
+        E.buf.rows = NULL;
+        return;
+    }
+    if (p->left == row) {
+        p->left = NULL;
+    } else {
+        p->right = NULL;
+    }
+    for (e_row *n = p; n; n = n->parent) n->count--;
+}
+
+// row memory
+static const unsigned short e_mem_size[MEM_CLASSES] = {
+    16, 24, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320,
+    384, 512, 640, 768, 1024, 1280, 1536, 2048, 2560, 3072, 4096,
+};
+
+static int e_mem_class(size_t n) {
+    static unsigned char cls[PAGU_MEM_SMALL / 8 + 1];
+    if (cls[PAGU_MEM_SMALL / 8] == 0) {
+        for (int i = 0, c = 0; i <= PAGU_MEM_SMALL / 8; i++) {
+            while (e_mem_size[c] < i * 8) c++;
+            cls[i] = c;
+        }
+    }
+    return cls[(n + 7) / 8];
+}
+
+static size_t e_mem_cap(size_t n) {
+    if (n <= PAGU_MEM_SMALL) {
+        return e_mem_size[e_mem_class(n)];
+    }
+    size_t cap = PAGU_MEM_SMALL;
+    while (cap < n) cap *= 2;
+    return cap;
+}
+
+void *e_mem_alloc(size_t n) {
+    size_t cap = e_mem_cap(n);
+    E.buf.mem.live += n;
+    E.buf.mem.used += cap;
+    if (n > PAGU_MEM_SMALL) {
+        struct e_big *b = malloc(sizeof(struct e_big) + cap);
+        if (b == NULL) {
+            die("malloc");
+        }
+        b->cap = cap;
+        b->prev = NULL;
+        b->next = E.buf.mem.big;
+        if (b->next) b->next->prev = b;
+        E.buf.mem.big = b;
+        E.buf.mem.large += cap;
+        return b->data;
+    }
+    int c = e_mem_class(n);
+    void *p = E.buf.mem.free[c];
+    if (p) {
+        E.buf.mem.free[c] = *(void **)p;
+        return p;
+    }
+    if (E.buf.mem.end - E.buf.mem.bump < (ptrdiff_t)cap) {
+        struct e_slab *slab = malloc(sizeof(struct e_slab) + PAGU_SLAB);
+        if (slab == NULL) {
+            die("malloc");
+        }
+        slab->size = PAGU_SLAB;
+        slab->next = E.buf.mem.slabs;
+        E.buf.mem.slabs = slab;
+        E.buf.mem.bump = slab->data;
+        E.buf.mem.end = slab->data + PAGU_SLAB;
+        E.buf.mem.slab += PAGU_SLAB;
+        E.buf.mem.nslabs++;
+    }
+    p = E.buf.mem.bump;
+    E.buf.mem.bump += cap;
+    return p;
+}
+
+void e_mem_free(void *p, size_t n) {
+    if (p == NULL) {
+        return;
+    }
+    size_t cap = e_mem_cap(n);
+    E.buf.mem.live -= n;
+    E.buf.mem.used -= cap;
+    if (n > PAGU_MEM_SMALL) {
+        struct e_big *b = (struct e_big *)((char *)p - offsetof(struct e_big, data));
+        if (b->prev) b->prev->next = b->next;
+        else E.buf.mem.big = b->next;
+        if (b->next) b->next->prev = b->prev;
+        E.buf.mem.large -= cap;
+        free(b);
+        return;
+    }
+    int c = e_mem_class(n);
+    *(void **)p = E.buf.mem.free[c];
+    E.buf.mem.free[c] = p;
+}
+
+void *e_mem_realloc(void *p, size_t old, size_t n) {
+    if (p == NULL) {
+        return e_mem_alloc(n);
+    }
+    if (e_mem_cap(old) == e_mem_cap(n)) {
+        E.buf.mem.live += n - old;
+        return p;
+    }
+    void *q = e_mem_alloc(n);
+    memcpy(q, p, old < n ? old : n);
+    e_mem_free(p, old);
+    E.stats.allocs++;
+    return q;
+}
+
+void e_mem_free_all() {
+    while (E.buf.mem.slabs) {
+        struct e_slab *next = E.buf.mem.slabs->next;
+        free(E.buf.mem.slabs);
+        E.buf.mem.slabs = next;
+    }
+    while (E.buf.mem.big) {
+        struct e_big *next = E.buf.mem.big->next;
+        free(E.buf.mem.big);
+        E.buf.mem.big = next;
+    }
+    memset(&E.buf.mem, 0, sizeof(E.buf.mem));
+}
+
+// row operations
+void e_insert_row(int at, char *s, size_t len) {
+    if (at < 0 || at > E.buf.n_rows) {
+        return;
+    }
+    e_undo_record(UNDO_INSERT_ROW, at, 0, s, len);
+    e_row *row = e_mem_alloc(sizeof(e_row));
+    row->size = len;
+    if (E.buf.stream.ring) {
+        // a ring drops rows from the top, so they keep their own text
+        row->chars = e_mem_alloc(len + 1);
+        memcpy(row->chars, s, len);
+        row->chars[len] = '\0';
+        row->flags = ROW_DAMAGED;
+    } else {
+        row->chars = e_add_text(s, len);
+        row->flags = ROW_ADDED | ROW_DAMAGED;
+    }
+    row->hl = NULL;
+    row->cache_slot = 0;
+    rt_link(at, row);
+    E.buf.n_rows++;
+
+    e_row *prev = e_row_prev(row);
+    row->hl_state = prev ? prev->hl_state : 0;
+    if (at < E.buf.hl_frontier) {
+        E.buf.hl_frontier++;
+        e_syntax_cascade(row, row->hl_state);
+    }
+
+    E.buf.dirty++;
+    E.buf.gen++;
+}
+
+void e_update_row(e_row *row) {
+    if (row->flags & ROW_CHUNKED) {
+        if (row->hl) {
+            e_cache_add(row);
+            e_update_syntax(row);
+        }
+        return;
+    }
+    e_cache_add(row);
+    if (memchr(row->chars, '\t', row->size)) {
+        row->flags &= ~ROW_NOTABS;
+    } else {
+        row->flags |= ROW_NOTABS;
+    }
+    if (row->hl == NULL) {
+        row->hl = e_mem_alloc(row->size + 1);
+        E.stats.allocs++;
+    }
+    e_update_syntax(row);
+}
+
+void e_row_render(e_row *row) {
+    if (row->size > PAGU_LONG_ROW) {
+        e_row_chunk(row);
+    }
+    if (row->hl == NULL) {
+        e_update_row(row);
+    }
+}
+
+void e_row_own(e_row *row) {
+    if (!(row->flags & ROW_VIEW)) {
+        return;
+    }
+    char *chars = e_mem_alloc(row->size + 1);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    row->chars = chars;
+    row->flags &= ~ROW_VIEW;
+}
+
+int e_row_span(e_row *row, int span, const char **p) {
+    if (row->flags & ROW_CHUNKED) {
+        if (span >= row->segs->n) {
+            return 0;
+        }
+        *p = row->segs->seg[span]->data;
+        return row->segs->seg[span]->len;
+    }
+    *p = row->chars;
+    return span == 0 ? row->size : 0;
+}
+
+static int e_seg_find(struct e_segs *g, int *at) {
+    int i = 0;
+    while (i < g->n - 1 && *at >= g->seg[i]->len) {
+        *at -= g->seg[i]->len;
+        i++;
+    }
+    return i;
+}
+
+void e_row_copy(e_row *row, int at, int len, char *dst) {
+    if (!(row->flags & ROW_CHUNKED)) {
+        memcpy(dst, &row->chars[at], len);
+        return;
+    }
+    struct e_segs *g = row->segs;
+    for (int i = e_seg_find(g, &at); len > 0; i++, at = 0) {
+        int n = g->seg[i]->len - at < len ? g->seg[i]->len - at : len;
+        memcpy(dst, &g->seg[i]->data[at], n);
+        dst += n;
+        len -= n;
+    }
+}
+
+static struct e_seg *e_seg_new(struct e_segs *g, int at) {
+    if (g->n == g->cap) {
+        int cap = g->cap ? g->cap * 2 : 16;
+        g->seg = e_mem_realloc(g->seg, sizeof(struct e_seg *) * g->cap,
+                               sizeof(struct e_seg *) * cap);
+        g->cap = cap;
+    }
+    memmove(&g->seg[at + 1], &g->seg[at], sizeof(struct e_seg *) * (g->n - at));
+    g->n++;
+    struct e_seg *seg = e_mem_alloc(sizeof(struct e_seg));
+    seg->len = 0;
+    seg->hl_in = -1;
+    g->seg[at] = seg;
+    return seg;
+}
+
+static void e_seg_put(struct e_segs *g, int *i, const char *s, int n, int fill) {
+    while (n > 0) {
+        struct e_seg *seg = g->seg[*i];
+        int room = fill - seg->len;
+        if (room <= 0) {
+            seg = e_seg_new(g, ++*i);
+            room = fill;
+        }
+        int k = n < room ? n : room;
+        memcpy(&seg->data[seg->len], s, k);
+        seg->len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+void e_row_chunk(e_row *row) {
+    if (row->flags & ROW_CHUNKED) {
+        return;
+    }
+    e_cache_evict(row);
+    if (!(row->flags & ROW_NOTABS) && !memchr(row->chars, '\t', row->size)) {
+        row->flags |= ROW_NOTABS;
+    }
+    struct e_segs *g = e_mem_alloc(sizeof(struct e_segs));
+    memset(g, 0, sizeof(*g));
+    g->hl_end = -1;
+    g->hl_win_in = -1;
+    int i = 0;
+    e_seg_new(g, 0);
+    e_seg_put(g, &i, row->chars, row->size, SEG_ROOM * 3 / 4);
+    if (!(row->flags & ROW_VIEW)) {
+        e_mem_free(row->chars, row->size + 1);
+    }
+    row->flags &= ~ROW_VIEW;
+    row->flags |= ROW_CHUNKED;
+    row->segs = g;
+}
+
+static void e_segs_free(struct e_segs *g) {
+    for (int i = 0; i < g->n; i++) {
+        e_mem_free(g->seg[i], sizeof(struct e_seg));
+    }
+    e_mem_free(g->seg, sizeof(struct e_seg *) * g->cap);
+    e_mem_free(g, sizeof(struct e_segs));
+}
+
+char *e_row_flat(e_row *row) {
+    if (!(row->flags & ROW_CHUNKED)) {
+        return row->chars;
+    }
+    e_cache_evict(row);
+    struct e_segs *g = row->segs;
+    char *chars = e_mem_alloc(row->size + 1);
+    e_row_copy(row, 0, row->size, chars);
+    chars[row->size] = '\0';
+    e_segs_free(g);
+    row->chars = chars;
+    row->flags &= ~ROW_CHUNKED;
+    return chars;
+}
+
+void e_row_window(e_row *row, int at, int len) {
+    struct e_segs *g = row->segs;
+    if (at > row->size) {
+        at = row->size;
+    }
+    if (len > row->size - at) {
+        len = row->size - at;
+    }
+    if (row->hl && at >= g->hl_at && at + len <= g->hl_at + g->hl_len) {
+        e_cache_add(row);
+        return;
+    }
+    e_cache_evict(row);
+    g->hl_win_in = -1;
+    g->hl_at = at > PAGU_HL_MARGIN ? at - PAGU_HL_MARGIN : 0;
+    g->hl_len = at + len + PAGU_HL_MARGIN - g->hl_at;
+    if (g->hl_len > row->size - g->hl_at) {
+        g->hl_len = row->size - g->hl_at;
+    }
+    e_cache_add(row);
+    row->hl = e_mem_alloc(g->hl_len + 1);
+    E.stats.allocs++;
+    e_update_syntax(row);
+}
+
+static int e_row_cmp(e_row *row, int at, const char *s, int len) {
+    if (!(row->flags & ROW_CHUNKED)) {
+        return memcmp(&row->chars[at], s, len);
+    }
+    struct e_segs *g = row->segs;
+    for (int i = e_seg_find(g, &at); len > 0; i++, at = 0) {
+        int n = g->seg[i]->len - at < len ? g->seg[i]->len - at : len;
+        int r = memcmp(&g->seg[i]->data[at], s, n);
+        if (r) {
+            return r;
+        }
+        s += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static const char *e_row_text(e_row *row, char **buf, int *cap) {
+    if (!(row->flags & ROW_CHUNKED)) {
+        return row->chars;
+    }
+    if (row->size + 1 > *cap) {
+        *cap = row->size + 1;
+        free(*buf);
+        *buf = malloc(*cap);
+    }
+    e_row_copy(row, 0, row->size, *buf);
+    (*buf)[row->size] = '\0';
+    return *buf;
+}
+
+// segments from+1 to `to` changed or follow a change
+static void e_seg_stale(struct e_segs *g, int from, int to) {
+    for (int k = from + 1; k <= to && k < g->n; k++) {
+        g->seg[k]->hl_in = -1;
+    }
+    if (from < g->hl_from) {
+        g->hl_from = from;
+    }
+}
+
+static void e_seg_insert(e_row *row, int at, const char *s, int len) {
+    struct e_segs *g = row->segs;
+    int i = e_seg_find(g, &at);
+    int first = i;
+    struct e_seg *seg = g->seg[i];
+    if (seg->len + len <= SEG_ROOM) {
+        memmove(&seg->data[at + len], &seg->data[at], seg->len - at);
+        memcpy(&seg->data[at], s, len);
+        seg->len += len;
+        e_seg_stale(g, i, i + 1);
+        return;
+    }
+    if (at < seg->len) {
+        struct e_seg *tail = e_seg_new(g, i + 1);
+        tail->len = seg->len - at;
+        memcpy(tail->data, &seg->data[at], tail->len);
+        seg->len = at;
+    }
+    e_seg_put(g, &i, s, len, SEG_ROOM);
+    e_seg_stale(g, first, i + 1);
+}
+
+static void e_seg_delete(e_row *row, int at, int len) {
+    struct e_segs *g = row->segs;
+    int i = e_seg_find(g, &at);
+    int first = i;
+    while (len > 0) {
+        struct e_seg *seg = g->seg[i];
+        int k = seg->len - at < len ? seg->len - at : len;
+        memmove(&seg->data[at], &seg->data[at + k], seg->len - at - k);
+        seg->len -= k;
+        len -= k;
+        if (seg->len == 0 && g->n > 1) {
+            e_mem_free(seg, sizeof(struct e_seg));
+            g->n--;
+            memmove(&g->seg[i], &g->seg[i + 1], sizeof(struct e_seg *) * (g->n - i));
+            // its successor moved in with the wrong entry state
+            if (i == first && first > 0) {
+                first--;
+            }
+        } else {
+            i++;
+        }
+        at = 0;
+    }
+    e_seg_stale(g, first, i);
+}
+
+static void e_seg_shift_hl(e_row *row, int at, int len) {
+    struct e_segs *g = row->segs;
+    if (row->hl == NULL || at < g->hl_at || (len > 0 ? at : at - len) > g->hl_at + g->hl_len) {
+        g->hl_win_in = -1;
+    }
+    if (row->hl == NULL || at > g->hl_at + g->hl_len) {
+        return;
+    }
+    if (len > 0 && at >= g->hl_at) {
+        row->hl = e_mem_realloc(row->hl, g->hl_len + 1, g->hl_len + len + 1);
+        memmove(&row->hl[at - g->hl_at + len], &row->hl[at - g->hl_at],
+                g->hl_len - (at - g->hl_at));
+        memset(&row->hl[at - g->hl_at], HL_NORMAL, len);
+        g->hl_len += len;
+    } else if (len > 0) {
+        g->hl_at += len;
+    } else if (at - len <= g->hl_at) {
+        g->hl_at += len;
+    } else if (at >= g->hl_at && at - len <= g->hl_at + g->hl_len) {
+        memmove(&row->hl[at - g->hl_at], &row->hl[at - g->hl_at - len],
+                g->hl_len - (at - g->hl_at - len));
+        row->hl = e_mem_realloc(row->hl, g->hl_len + 1, g->hl_len + len + 1);
+        g->hl_len += len;
+    } else {
+        e_cache_evict(row);
+    }
+}
+
+char *e_add_text(const char *s, size_t len) {
+    struct e_add_chunk *c = E.buf.add;
+    if (c == NULL || c->size - c->used < len + 1) {
+        size_t size = len + 1 > PAGU_ADD_CHUNK ? len + 1 : PAGU_ADD_CHUNK;
+        c = malloc(sizeof(struct e_add_chunk) + size);
+        if (c == NULL) {
+            die("malloc");
+        }
+        c->size = size;
+        c->used = 0;
+        if (E.buf.add && E.buf.add->size - E.buf.add->used > PAGU_ADD_CHUNK / 16) {
+            c->next = E.buf.add->next;
+            E.buf.add->next = c;
+        } else {
+            c->next = E.buf.add;
+            E.buf.add = c;
+        }
+    }
+    char *p = c->data + c->used;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    c->used += len + 1;
+    return p;
+}
+
+void e_cache_evict(e_row *row) {
+    if (row->cache_slot) {
+        E.buf.cache.rows[row->cache_slot - 1] = NULL;
+        row->cache_slot = 0;
+    }
+    e_mem_free(row->hl, e_row_hl_len(row) + 1);
+    row->hl = NULL;
+    row->flags &= ~ROW_REF;
+}
+
+// clock sweep: evicts the first row unused since its last pass
+void e_cache_add(e_row *row) {
+    row->flags |= ROW_REF;
+    if (row->cache_slot) {
+        return;
+    }
+    if (E.buf.cache.rows == NULL) {
+        E.buf.cache.rows = calloc(E.buf.cache.cap, sizeof(e_row *));
+    }
+    int slot;
+    if (E.buf.cache.n < E.buf.cache.cap) {
+        slot = E.buf.cache.n++;
+    } else {
+        for (;;) {
+            slot = E.buf.cache.hand;
+            E.buf.cache.hand = (E.buf.cache.hand + 1) % E.buf.cache.cap;
+            e_row *old = E.buf.cache.rows[slot];
+            if (old == NULL) {
+                break;
+            }
+            if (old->flags & ROW_REF) {
+                old->flags &= ~ROW_REF;
+                continue;
+            }
+            e_cache_evict(old);
+            break;
+        }
+    }
+    E.buf.cache.rows[slot] = row;
+    row->cache_slot = slot + 1;
+}
+
+int e_cxrx(e_row *row, int cx) {
+    if (row->flags & ROW_NOTABS) {
+        return cx;
+    }
+    int rx = 0;
+    const char *p;
+    int len;
+    for (int span = 0; cx > 0 && (len = e_row_span(row, span, &p)) > 0; span++) {
+        for (int i = 0; i < len && i < cx; i++) {
+            if (p[i] == '\t') {
+                rx += (PAGU_TAB_STOP - 1) - (rx % PAGU_TAB_STOP);
+            }
+            rx++;
+        }
+        cx -= len;
+    }
+    return rx;
+}
+
+int e_rxcx(e_row *row, int rx) {
+    if (row->flags & ROW_NOTABS) {
+        return rx < row->size ? rx : row->size;
+    }
+    int cur_rx = 0;
+    int cx = 0;
+    const char *p;
+    int len;
+    for (int span = 0; (len = e_row_span(row, span, &p)) > 0; span++) {
+        for (int i = 0; i < len; i++, cx++) {
+            if (p[i] == '\t') {
+                cur_rx += (PAGU_TAB_STOP - 1) - (cur_rx % PAGU_TAB_STOP);
+            }
+            cur_rx++;
+            if (cur_rx > rx) {
+                return cx;
+            }
+        }
+    }
+    return cx;
+}
+
+static void e_row_resize_hl(e_row *row, int old) {
+    if (row->hl) {
+        row->hl = e_mem_realloc(row->hl, old + 1, row->size + 1);
+    }
+}
+
+void e_row_insert_str(e_row *row, int at, const char *s, size_t len) {
+    if (at < 0 || at > row->size) {
+        at = row->size;
+    }
+    e_undo_record(UNDO_INSERT, e_row_idx(row), at, s, len);
+    int old = row->size;
+    if (old + len > PAGU_LONG_ROW) {
+        e_row_chunk(row);
+    }
+    if (row->flags & ROW_CHUNKED) {
+        e_seg_insert(row, at, s, len);
+        if (memchr(s, '\t', len)) {
+            row->flags &= ~ROW_NOTABS;
+        }
+        row->size += len;
+        e_seg_shift_hl(row, at, len);
+        e_update_row(row);
+        E.buf.dirty++;
+        E.buf.gen++;
+        return;
+    }
+    if (row->flags & ROW_VIEW) {
+        char *chars = e_mem_alloc(old + len + 1);
+        memcpy(chars, row->chars, at);
+        memcpy(&chars[at + len], &row->chars[at], old - at);
+        chars[old + len] = '\0';
+        row->chars = chars;
+        row->flags &= ~ROW_VIEW;
+    } else {
+        row->chars = e_mem_realloc(row->chars, old + 1, old + len + 1);
+        memmove(&row->chars[at + len], &row->chars[at], old - at + 1);
+    }
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    e_row_resize_hl(row, old);
+    e_update_row(row);
+    E.buf.dirty++;
+    E.buf.gen++;
+}
+
+void e_row_delete_str(e_row *row, int at, int len) {
+    if (at < 0 || at >= row->size) {
+        return;
+    }
+    if (len > row->size - at) {
+        len = row->size - at;
+    }
+    if (row->flags & ROW_CHUNKED) {
+        char *cut = malloc(len);
+        e_row_copy(row, at, len, cut);
+        e_undo_record(UNDO_DELETE, e_row_idx(row), at, cut, len);
+        free(cut);
+        e_seg_delete(row, at, len);
+        row->size -= len;
+        e_seg_shift_hl(row, at, -len);
+        e_update_row(row);
+        E.buf.dirty++;
+        E.buf.gen++;
+        return;
+    }
+    e_undo_record(UNDO_DELETE, e_row_idx(row), at, &row->chars[at], len);
+    if ((row->flags & ROW_VIEW) && (at == 0 || at + len == row->size)) {
+        if (at == 0) {
+            row->chars += len;
+        }
+    } else {
+        e_row_own(row);
+        memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+        row->chars = e_mem_realloc(row->chars, row->size + 1, row->size - len + 1);
+    }
+    row->size -= len;
+    e_row_resize_hl(row, row->size + len);
+    e_update_row(row);
+    E.buf.dirty++;
+    E.buf.gen++;
+}
+
+void e_row_insert_char(e_row *row, int at, int c) {
+    char ch = c;
+    e_row_insert_str(row, at, &ch, 1);
+}
+
+void e_row_delete_char(e_row *row, int at) {
+    e_row_delete_str(row, at, 1);
+}
+
+void e_free_row(e_row *row) {
+    e_cache_evict(row);
+    if (row->flags & ROW_CHUNKED) {
+        e_segs_free(row->segs);
+    } else if (!(row->flags & ROW_VIEW)) {
+        e_mem_free(row->chars, row->size + 1);
+    }
+}
+
+void e_del_row(int at) {
+    if (at < 0 || at >= E.buf.n_rows) {
+        return;
+    }
+    e_row *row = e_row_at(at);
+    e_undo_record_row(at, row);
+    e_row *prev = e_row_prev(row);
+    e_row *next = e_row_next(row);
+    int in_state = prev ? prev->hl_state : 0;
+    int out_state = row->hl_state;
+    rt_unlink(row);
+    if (at < E.buf.hl_frontier) {
+        E.buf.hl_frontier--;
+        if (in_state != out_state) {
+            e_syntax_cascade(next, in_state);
+        }
+    }
+    e_free_row(row);
+    if (!(row->flags & ROW_BLOCK)) {
+        e_mem_free(row, sizeof(e_row));
+    }
+    E.buf.n_rows--;
+    E.buf.dirty++;
+    E.buf.gen++;
+}
+
+void e_row_truncate(e_row *row, int at) {
+    e_row_delete_str(row, at, row->size - at);
+}
+
+void e_row_append_str(e_row *row, char *s, size_t len) {
+    e_row_insert_str(row, row->size, s, len);
+}
+
+// editor operations
+void e_insert_char(int c) {
+    if (E.buf.cy == E.buf.n_rows) {
+        e_insert_row(E.buf.n_rows, "", 0);
+    }
+    e_row_insert_char(e_row_at(E.buf.cy), E.buf.cx, c);
+    E.buf.cx++;
+}
+
+void e_delete_char() {
+    if (E.buf.cy == E.buf.n_rows || (E.buf.cx == 0 && E.buf.cy == 0)) {
+        return;
+    }
+
+    if (E.buf.cx > 0) {
+        e_row_delete_char(e_row_at(E.buf.cy), E.buf.cx - 1);
+        E.buf.cx--;
+    } else {
+        e_row *row = e_row_at(E.buf.cy);
+        e_row *prev = e_row_prev(row);
+        E.buf.cx = prev->size;
+        if (row->flags & ROW_CHUNKED) {
+            for (int i = 0; i < row->segs->n; i++) {
+                e_row_append_str(prev, row->segs->seg[i]->data, row->segs->seg[i]->len);
+            }
+        } else {
+            e_row_append_str(prev, row->chars, row->size);
+        }
+        e_del_row(E.buf.cy);
+        E.buf.cy--;
+    }
+}
+
+void e_insert_newline() {
+    if (E.buf.cx == 0) {
+        e_insert_row(E.buf.cy, "", 0);
+    } else {
+        e_row *row = e_row_at(E.buf.cy);
+        char *tail = malloc(row->size - E.buf.cx + 1);
+        e_row_copy(row, E.buf.cx, row->size - E.buf.cx, tail);
+        e_insert_row(E.buf.cy + 1, tail, row->size - E.buf.cx);
+        free(tail);
+        e_row_truncate(row, E.buf.cx);
+    }
+    E.buf.cy++;
+    E.buf.cx = 0;
+}
+
+void e_insert_text(const char *s, size_t len) {
+    if (E.buf.cy == E.buf.n_rows) {
+        e_insert_row(E.buf.n_rows, "", 0);
+    }
+    if (E.buf.hl_frontier > E.buf.cy) {
+        E.buf.hl_frontier = E.buf.cy;
+    }
+    e_row *row = e_row_at(E.buf.cy);
+    size_t tail_len = row->size - E.buf.cx;
+    char *tail = malloc(tail_len + 1);
+    e_row_copy(row, E.buf.cx, tail_len, tail);
+
+    const char *end = s + len;
+    const char *eol = s;
+    while (eol < end && *eol != '\r' && *eol != '\n') eol++;
+    e_row_truncate(row, E.buf.cx);
+    e_row_append_str(row, (char *)s, eol - s);
+    E.buf.cx += eol - s;
+
+    char *line = NULL;
+    size_t linecap = 0;
+    while (eol < end) {
+        s = eol + ((*eol == '\r' && eol + 1 < end && eol[1] == '\n') ? 2 : 1);
+        eol = s;
+        while (eol < end && *eol != '\r' && *eol != '\n') eol++;
+        size_t n = eol - s;
+        if (eol < end) {
+            e_insert_row(E.buf.cy + 1, (char *)s, n);
+        } else {
+            if (n + tail_len > linecap) {
+                linecap = n + tail_len;
+                line = realloc(line, linecap + 1);
+            }
+            memcpy(line, s, n);
+            memcpy(line + n, tail, tail_len);
+            e_insert_row(E.buf.cy + 1, line, n + tail_len);
+            tail_len = 0;
+        }
+        E.buf.cy++;
+        E.buf.cx = n;
+    }
+    if (tail_len) {
+        e_row_append_str(e_row_at(E.buf.cy), tail, tail_len);
+    }
+    free(line);
+    free(tail);
+}
+
+// undo
+static void e_undo_release(struct e_undo_chunk *c) {
+    E.buf.undo.bytes -= c->size;
+    if (!E.buf.undo.spare && c->size == PAGU_UNDO_CHUNK) {
+        E.buf.undo.spare = c;
+    } else {
+        free(c);
+    }
+}
+
+static struct e_undo_rec *e_undo_alloc(int len) {
+    size_t need = UNDO_SIZE(len);
+    struct e_undo_chunk *c = E.buf.undo.tail;
+    if (!c || c->size - c->used < need) {
+        if (need <= PAGU_UNDO_CHUNK && E.buf.undo.spare) {
+            c = E.buf.undo.spare;
+            E.buf.undo.spare = NULL;
+        } else {
+            size_t size = need > PAGU_UNDO_CHUNK ? need : PAGU_UNDO_CHUNK;
+            c = malloc(sizeof(struct e_undo_chunk) + size);
+            if (c == NULL) {
+                return NULL;
+            }
+            c->size = size;
+        }
+        c->used = 0;
+        c->next = NULL;
+        if (E.buf.undo.tail) {
+            E.buf.undo.tail->next = c;
+        } else {
+            E.buf.undo.head = c;
+        }
+        E.buf.undo.tail = c;
+        E.buf.undo.bytes += c->size;
+    }
+    struct e_undo_rec *rec = (struct e_undo_rec *)(c->data + c->used);
+    c->used += need;
+    rec->cap = need - sizeof(struct e_undo_rec);
+    return rec;
+}
+
+static int e_undo_grow(struct e_undo_rec *rec, int n) {
+    if (rec->len + n <= rec->cap) {
+        return 1;
+    }
+    struct e_undo_chunk *c = E.buf.undo.tail;
+    size_t more = UNDO_SIZE(rec->len + n) - UNDO_SIZE(rec->cap);
+    if ((char *)rec + UNDO_SIZE(rec->cap) != c->data + c->used ||
+        c->size - c->used < more) {
+        return 0;
+    }
+    c->used += more;
+    rec->cap += more;
+    return 1;
+}
+
+static void e_undo_drop_redo() {
+    struct e_undo_chunk *c = E.buf.undo.head;
+    struct e_undo_rec *top = E.buf.undo.top;
+    if (top) {
+        while ((char *)top < c->data || (char *)top >= c->data + c->used) {
+            c = c->next;
+        }
+        c->used = (char *)top + UNDO_SIZE(top->cap) - c->data;
+        top->next = NULL;
+        E.buf.undo.tail = c;
+        c = c->next;
+        E.buf.undo.tail->next = NULL;
+    } else {
+        E.buf.undo.head = E.buf.undo.tail = NULL;
+        E.buf.undo.first = NULL;
+    }
+    while (c) {
+        struct e_undo_chunk *next = c->next;
+        e_undo_release(c);
+        c = next;
+    }
+    E.buf.undo.last = top;
+}
+
+// frees the oldest chunks until the history fits its limit
+static void e_undo_trim() {
+    while (E.buf.undo.bytes > E.buf.undo.limit && E.buf.undo.head != E.buf.undo.tail) {
+        struct e_undo_chunk *c = E.buf.undo.head;
+        struct e_undo_rec *rec = E.buf.undo.first;
+        int cut = 0;
+        uint32_t group = 0;
+        while (rec && (char *)rec >= c->data &&
+               (char *)rec < c->data + c->used) {
+            group = rec->group;
+            cut = 1;
+            rec = rec->next;
+        }
+        while (cut && rec && rec->group == group) {
+            rec = rec->next;
+        }
+        if (rec == NULL) {
+            E.buf.undo.dropped = group;
+            E.buf.undo.top = NULL;
+            e_undo_drop_redo();
+            return;
+        }
+        rec->prev = NULL;
+        E.buf.undo.first = rec;
+        E.buf.undo.head = c->next;
+        e_undo_release(c);
+    }
+}
+
+static void e_undo_add(int, int, int, const char *, e_row *, int);
+
+void e_undo_record(int op, int row, int at, const char *s, int len) {
+    e_journal_record(op, row, at, s, len);
+    if (E.buf.undo.off || E.buf.undo.group == E.buf.undo.dropped) {
+        return;
+    }
+    if (E.buf.undo.top != E.buf.undo.last) {
+        e_undo_drop_redo();
+    }
+
+    struct e_undo_rec *rec = E.buf.undo.top;
+    if (rec && rec->group == E.buf.undo.group && rec->op == op &&
+        rec->row == row && (op == UNDO_INSERT || op == UNDO_DELETE)) {
+        int append = at == rec->at + (op == UNDO_INSERT ? rec->len : 0);
+        int prepend = op == UNDO_DELETE && at + len == rec->at;
+        if ((append || prepend) && e_undo_grow(rec, len)) {
+            if (prepend) {
+                memmove(rec->text + len, rec->text, rec->len);
+                memcpy(rec->text, s, len);
+                rec->at = at;
+            } else {
+                memcpy(rec->text + rec->len, s, len);
+            }
+            rec->len += len;
+            return;
+        }
+    }
+
+    e_undo_add(op, row, at, s, NULL, len);
+}
+
+// a deleted row's text, copied from its segments if it has them
+void e_undo_record_row(int row, e_row *src) {
+    if (!(src->flags & ROW_CHUNKED)) {
+        e_undo_record(UNDO_DEL_ROW, row, 0, src->chars, src->size);
+        return;
+    }
+    e_journal_record(UNDO_DEL_ROW, row, 0, NULL, src->size);
+    if (E.buf.undo.off || E.buf.undo.group == E.buf.undo.dropped) {
+        return;
+    }
+    if (E.buf.undo.top != E.buf.undo.last) {
+        e_undo_drop_redo();
+    }
+    e_undo_add(UNDO_DEL_ROW, row, 0, NULL, src, src->size);
+}
+
+static void e_undo_add(int op, int row, int at, const char *s, e_row *src, int len) {
+    struct e_undo_rec *rec = e_undo_alloc(len);
+    if (rec == NULL) {
+        return;
+    }
+    rec->group = E.buf.undo.group;
+    rec->op = op;
+    rec->row = row;
+    rec->at = at;
+    rec->len = len;
+    if (src) {
+        e_row_copy(src, 0, len, rec->text);
+    } else {
+        memcpy(rec->text, s, len);
+    }
+    rec->bx = E.buf.undo.bx;
+    rec->by = E.buf.undo.by;
+    rec->ax = E.buf.cx;
+    rec->ay = E.buf.cy;
+    rec->next = NULL;
+    rec->prev = E.buf.undo.last;
+    if (E.buf.undo.last) {
+        E.buf.undo.last->next = rec;
+    } else {
+        E.buf.undo.first = rec;
+    }
+    E.buf.undo.top = E.buf.undo.last = rec;
+    e_undo_trim();
+}
+
+void e_undo_begin(int key) {
+    int kind = 0;
+    if (key == BACKSPACE || key == CTRL_KEY('h')) {
+        kind = 2;
+    } else if (key == DEL_KEY) {
+        kind = 3;
+    } else if (key == '\t' || (key >= ' ' && key < ARROW_LEFT)) {
+        kind = 1;
+    }
+    if (!kind || kind != E.buf.undo.kind || E.buf.cx != E.buf.undo.cx ||
+        E.buf.cy != E.buf.undo.cy) {
+        E.buf.undo.group++;
+        E.buf.undo.bx = E.buf.cx;
+        E.buf.undo.by = E.buf.cy;
+    }
+    E.buf.undo.kind = kind;
+}
+
+void e_undo_end() {
+    E.buf.undo.cx = E.buf.cx;
+    E.buf.undo.cy = E.buf.cy;
+    if (E.buf.undo.top && E.buf.undo.top->group == E.buf.undo.group) {
+        E.buf.undo.top->ax = E.buf.cx;
+        E.buf.undo.top->ay = E.buf.cy;
+    }
+}
+
+static void e_undo_apply(struct e_undo_rec *rec, int inverse) {
+    switch (inverse ? rec->op ^ 1 : rec->op) {
+    case UNDO_INSERT:
+        e_row_insert_str(e_row_at(rec->row), rec->at, rec->text, rec->len);
+        break;
+    case UNDO_DELETE:
+        e_row_delete_str(e_row_at(rec->row), rec->at, rec->len);
+        break;
+    case UNDO_INSERT_ROW:
+        e_insert_row(rec->row, rec->text, rec->len);
+        break;
+    case UNDO_DEL_ROW:
+        e_del_row(rec->row);
+        break;
+    }
+}
+
+static void e_undo_cursor(int cx, int cy) {
+    E.buf.cy = cy > E.buf.n_rows ? E.buf.n_rows : cy;
+    int size = E.buf.cy < E.buf.n_rows ? e_row_at(E.buf.cy)->size : 0;
+    E.buf.cx = cx > size ? size : cx;
+}
+
+void e_undo() {
+    struct e_undo_rec *rec = E.buf.undo.top;
+    if (rec == NULL) {
+        e_set_status_msg("Nothing to undo");
+        return;
+    }
+    uint32_t group = rec->group;
+    E.buf.undo.off++;
+    for (; rec && rec->group == group; rec = rec->prev) {
+        e_undo_apply(rec, 1);
+        e_undo_cursor(rec->bx, rec->by);
+    }
+    E.buf.undo.off--;
+    E.buf.undo.top = rec;
+}
+
+void e_redo() {
+    struct e_undo_rec *rec = E.buf.undo.top ? E.buf.undo.top->next : E.buf.undo.first;
+    if (rec == NULL) {
+        e_set_status_msg("Nothing to redo");
+        return;
+    }
+    uint32_t group = rec->group;
+    E.buf.undo.off++;
+    for (; rec && rec->group == group; rec = rec->next) {
+        e_undo_apply(rec, 0);
+        e_undo_cursor(rec->ax, rec->ay);
+        E.buf.undo.top = rec;
+    }
+    E.buf.undo.off--;
+}
+
+// file IO
+int e_open(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    free(E.buf.filename);
+    E.buf.filename = strdup(filename);
+
+    e_select_hl();
+
+    struct stat st;
+    if (E.buf.n_rows == 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            e_sidecar_load(fd, &st, map);
+            E.buf.dirty = 0;
+            e_journal_open(fd);
+            close(fd);
+            return 0;
+        }
+    }
+
+    FILE *fp = fdopen(fd, "r");
+    if (!fp) {
+        die("fdopen");
+    }
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    E.buf.undo.off++;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 &&
+               (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
+            linelen--;
+        }
+        e_insert_row(E.buf.n_rows, line, linelen);
+    }
+    E.buf.undo.off--;
+    free(line);
+    E.buf.dirty = 0;
+    e_journal_open(fileno(fp));
+    fclose(fp);
+    return 0;
+}
+
+void e_stream_open(int fd, char *filename) {
+    struct stat st;
+    E.buf.stream.follow = 1;
+    E.buf.stream.fd = fd;
+    E.buf.stream.pipe = fstat(fd, &st) == -1 || !S_ISREG(st.st_mode);
+    if (E.buf.stream.pipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    E.buf.stream.ring = E.stream_lines;
+    E.buf.stream.part = (struct abuf)ABUF_INIT;
+    E.buf.readonly = 1;
+    if (filename) {
+        E.buf.filename = strdup(filename);
+        e_select_hl();
+    }
+    e_stream_read();
+}
+
+int e_stream_read() {
+    static char buf[65536];
+    int fd = E.buf.stream.fd;
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    if (!E.buf.stream.pipe && fstat(fd, &st) == 0 && st.st_size < E.buf.stream.off) {
+        // truncated under us, as logs are when rotated: start over
+        lseek(fd, 0, SEEK_SET);
+        E.buf.stream.off = 0;
+    }
+    struct abuf *part = &E.buf.stream.part;
+    int tail = E.buf.cy >= E.buf.n_rows - 1;
+    int added = 0;
+    int replaced = 0;
+    unsigned long gen = E.buf.gen;
+    long total = 0;
+    E.buf.undo.off++;
+    while (total < PAGU_STREAM_CHUNK) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (E.buf.stream.partial && (n > 0 || (n == 0 && E.buf.stream.pipe))) {
+            e_del_row(E.buf.n_rows - 1);
+            E.buf.stream.partial = 0;
+            replaced = 1;
+        }
+        if (n == 0 && E.buf.stream.pipe) {
+            if (part->len) {
+                e_insert_row(E.buf.n_rows, part->b, part->len);
+                part->len = 0;
+                added++;
+            }
+            close(fd);
+            E.buf.stream.fd = -1;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+        E.buf.stream.off += n;
+        char *p = buf;
+        char *end = buf + n;
+        while (p < end) {
+            char *nl = memchr(p, '\n', end - p);
+            if (nl == NULL) {
+                ab_append(part, p, end - p);
+                break;
+            }
+            char *line = p;
+            size_t len = nl - p;
+            if (part->len) {
+                ab_append(part, p, len);
+                line = part->b;
+                len = part->len;
+            }
+            while (len > 0 && line[len - 1] == '\r') {
+                len--;
+            }
+            e_insert_row(E.buf.n_rows, line, len);
+            part->len = 0;
+            added++;
+            p = nl + 1;
+        }
+    }
+    if (part->len && !E.buf.stream.partial) {
+        size_t len = part->len;
+        while (len > 0 && part->b[len - 1] == '\r') {
+            len--;
+        }
+        e_insert_row(E.buf.n_rows, part->b, len);
+        E.buf.stream.partial = 1;
+        added++;
+    }
+    E.buf.stream.more = total >= PAGU_STREAM_CHUNK;
+    int dropped = 0;
+    while (E.buf.stream.ring && E.buf.n_rows > E.buf.stream.ring) {
+        e_del_row(0);
+        dropped++;
+    }
+    E.buf.undo.off--;
+    E.buf.dirty = 0;
+    e_find_drop(dropped);
+    if (dropped == 0 && !replaced) {
+        E.buf.gen = gen;
+    }
+    E.buf.cy = E.buf.cy > dropped ? E.buf.cy - dropped : 0;
+    E.buf.row_off = E.buf.row_off > dropped ? E.buf.row_off - dropped : 0;
+    if (tail && added) {
+        E.buf.cy = E.buf.n_rows - 1;
+        E.buf.cx = 0;
+    }
+    return added || dropped;
+}
+
+void e_close() {
+    e_sidecar_store(&E.buf);
+    e_journal_drop(&E.buf);
+    e_mem_free_all();
+    free(E.buf.row_block);
+    E.buf.row_block = NULL;
+    while (E.buf.add) {
+        struct e_add_chunk *next = E.buf.add->next;
+        free(E.buf.add);
+        E.buf.add = next;
+    }
+    if (E.buf.map) {
+        munmap(E.buf.map, E.buf.map_len);
+        E.buf.map = NULL;
+        E.buf.map_len = 0;
+    }
+    free(E.buf.cache.rows);
+    memset(&E.buf.cache, 0, sizeof(E.buf.cache));
+    E.buf.cache.cap = PAGU_RENDER_CACHE;
+    free(E.buf.find.m);
+    free(E.buf.find.query);
+    memset(&E.buf.find, 0, sizeof(E.buf.find));
+    if (E.buf.stream.follow) {
+        if (E.buf.stream.fd != -1) {
+            close(E.buf.stream.fd);
+        }
+        ab_free(&E.buf.stream.part);
+    }
+    memset(&E.buf.stream, 0, sizeof(E.buf.stream));
+    E.buf.readonly = 0;
+
+    struct e_undo_chunk *c = E.buf.undo.head;
+    while (c) {
+        struct e_undo_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(E.buf.undo.spare);
+    size_t limit = E.buf.undo.limit;
+    memset(&E.buf.undo, 0, sizeof(E.buf.undo));
+    E.buf.undo.limit = limit;
+
+    E.buf.rows = NULL;
+    E.buf.n_rows = 0;
+    E.buf.hl_frontier = 0;
+    E.buf.cx = E.buf.cy = 0;
+    E.buf.row_off = E.buf.col_off = 0;
+    E.buf.dirty = 0;
+    E.buf.gen++; // a scan the worker has in flight is stale now
+    E.frame_full = 1;
+    free(E.buf.filename);
+    E.buf.filename = NULL;
+    E.buf.syntax = NULL;
+    memset(&E.buf.disk, 0, sizeof(E.buf.disk));
+}
+
+static e_row *rt_build(e_row *rows, int n, int depth, e_row *parent) {
+    if (n == 0) {
+        return NULL;
+    }
+    int mid = n / 2;
+    e_row *row = &rows[mid];
+    row->parent = parent;
+    // priorities decrease with depth so the balanced shape is a valid treap
+    row->prio = ((uint32_t)(31 - depth) << 27) | (rt_rand() >> 5);
+    row->left = rt_build(rows, mid, depth + 1, row);
+    row->right = rt_build(rows + mid + 1, n - mid - 1, depth + 1, row);
+    row->count = n;
+    return row;
+}
+
+static void *e_index_part(void *arg) {
+    struct e_load_part *part = arg;
+    char *p = part->p;
+    int n = 0;
+    while (p < part->end) {
+        char *nl = memchr(p, '\n', part->end - p);
+        char *eol = nl ? nl : part->end;
+        char *next = nl ? nl + 1 : part->end;
+        if (part->rows) {
+            while (eol > p && eol[-1] == '\r') {
+                eol--;
+            }
+            e_row *row = &part->rows[n];
+            memset(row, 0, sizeof(e_row));
+            row->chars = p;
+            row->size = eol - p;
+            row->flags = ROW_MAPPED | ROW_BLOCK;
+        }
+        n++;
+        p = next;
+    }
+    part->n = n;
+    return NULL;
+}
+
+static void e_index_parts(struct e_load_part *parts, int n) {
+    int started = 0;
+    for (int j = 1; j < n; j++) {
+        if (pthread_create(&parts[j].thread, NULL, e_index_part, &parts[j]) != 0) {
+            break;
+        }
+        started = j;
+    }
+    for (int j = started + 1; j < n; j++) {
+        e_index_part(&parts[j]);
+    }
+    e_index_part(&parts[0]);
+    for (int j = 1; j <= started; j++) {
+        pthread_join(parts[j].thread, NULL);
+    }
+}
+
+// the result does not depend on the number of threads
+int e_index_rows(char *map, size_t len, int threads, e_row **out) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    if ((size_t)threads > len / PAGU_LOAD_CHUNK) {
+        threads = len / PAGU_LOAD_CHUNK;
+    }
+    if (threads > PAGU_LOAD_THREADS) {
+        threads = PAGU_LOAD_THREADS;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    struct e_load_part parts[PAGU_LOAD_THREADS];
+    char *end = map + len;
+    char *p = map;
+    int n = 0;
+    for (int j = 0; j < threads && p < end; j++) {
+        char *cut = j == threads - 1 ? end : map + len / threads * (j + 1);
+        if (cut < p) {
+            cut = p;
+        }
+        if (cut < end) {
+            char *nl = memchr(cut, '\n', end - cut);
+            cut = nl ? nl + 1 : end;
+        }
+        parts[n++] = (struct e_load_part){.p = p, .end = cut};
+        p = cut;
+    }
+
+    e_index_parts(parts, n);
+    int total = 0;
+    for (int j = 0; j < n; j++) {
+        total += parts[j].n;
+    }
+    e_row *rows = malloc(sizeof(e_row) * (total ? total : 1));
+    for (int j = 0, at = 0; j < n; j++) {
+        parts[j].rows = &rows[at];
+        at += parts[j].n;
+    }
+    e_index_parts(parts, n);
+    *out = rows;
+    return total;
+}
+
+static void e_open_rows(e_row *rows, int n) {
+    E.buf.row_block = rows;
+    E.buf.rows = rt_build(rows, n, 0, NULL);
+    E.buf.n_rows = n;
+}
+
+void e_open_mapped(char *map, size_t len) {
+    E.buf.map = map;
+    E.buf.map_len = len;
+
+    e_row *rows;
+    int n = e_index_rows(map, len, 0, &rows);
+    e_open_rows(rows, n);
+}
+
+static int e_writev_all(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+long long e_write_rows(int fd) {
+    static char newline = '\n';
+    struct iovec iov[PAGU_SAVE_IOV];
+    int n = 0;
+    long long total = 0;
+    for (e_row *row = e_row_at(0); row; row = e_row_next(row)) {
+        const char *p = NULL;
+        int span = 0;
+        size_t len = e_row_span(row, span, &p);
+        int own_newline = (row->flags & ROW_MAPPED) &&
+                          p + len < E.buf.map + E.buf.map_len && p[len] == '\n';
+        if (own_newline) {
+            len++;
+        }
+        for (;;) {
+            if (len > 0 && n &&
+                (char *)iov[n - 1].iov_base + iov[n - 1].iov_len == p) {
+                iov[n - 1].iov_len += len;
+            } else if (len > 0) {
+                if (n == PAGU_SAVE_IOV) {
+                    if (e_writev_all(fd, iov, n) == -1) {
+                        return -1;
+                    }
+                    n = 0;
+                }
+                iov[n].iov_base = (char *)p;
+                iov[n].iov_len = len;
+                n++;
+            }
+            total += len;
+            if (own_newline || p == &newline) {
+                break;
+            }
+            if ((len = e_row_span(row, ++span, &p)) == 0) {
+                p = &newline;
+                len = 1;
+            }
+        }
+    }
+    if (n && e_writev_all(fd, iov, n) == -1) {
+        return -1;
+    }
+    return total;
+}
+
+static int e_fsync_dir(const char *path) {
+    char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash - path + 1) : strdup(".");
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    if (fd == -1) {
+        return -1;
+    }
+    int r = fsync(fd);
+    close(fd);
+    return r;
+}
+
+// writes a temp file and renames it over the target
+int e_write_file(const char *filename, long long *written) {
+    char *path = realpath(filename, NULL);
+    if (path == NULL) {
+        path = strdup(filename);
+    }
+    char *slash = strrchr(path, '/');
+    int dir_len = slash ? slash - path + 1 : 0;
+    char *tmp;
+    if (asprintf(&tmp, "%.*s.%s.XXXXXX", dir_len, path,
+                 path + dir_len) == -1) {
+        free(path);
+        return -1;
+    }
+
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        free(tmp);
+        free(path);
+        return -1;
+    }
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+        // only root can give the file away; otherwise the copy stays ours
+        (void)!fchown(fd, st.st_uid, st.st_gid);
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0644 & ~mask);
+    }
+
+    long long len = e_write_rows(fd);
+    int ok = len != -1;
+    if (ok && E.fsync_policy >= 1) {
+        ok = fsync(fd) == 0;
+    }
+    if (close(fd) == -1) {
+        ok = 0;
+    }
+    if (ok) {
+        ok = rename(tmp, path) == 0;
+    }
+    if (ok && E.fsync_policy >= 2) {
+        ok = e_fsync_dir(path) == 0;
+    }
+    if (!ok) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+    }
+    free(tmp);
+    free(path);
+    *written = len;
+    return ok ? 0 : -1;
+}
+
+void e_save() {
+    if (E.buf.filename == NULL) {
+        E.buf.filename = e_prompt("Save as: %s (ESC to abort)", NULL);
+        if (E.buf.filename == NULL) {
+            e_set_status_msg("Save aborted");
+            return;
+        }
+        e_select_hl();
+    }
+    long long len;
+    if (e_write_file(E.buf.filename, &len) == 0) {
+        E.buf.dirty = 0;
+        e_journal_saved();
+        e_set_status_msg("%lld bytes written to disk", len);
+        return;
+    }
+    e_set_status_msg("Can't save! I/O error: %s", strerror(errno));
+}
+
+// sidecar
+static uint64_t e_fnv64(const void *p, size_t len, uint64_t h) {
+    const unsigned char *s = p;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ s[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV64_INIT 14695981039346656037ull
+
+// the sidecar or journal path for filename, by a hash of its real path
+static int e_sidecar_path(const char *filename, int journal, char *out, size_t cap,
+                          char **real) {
+    char *base = getenv(journal ? "XDG_STATE_HOME" : "XDG_CACHE_HOME");
+    char *home = getenv("HOME");
+    char dir[PATH_MAX];
+    if (base && *base) {
+        snprintf(dir, sizeof(dir), "%s/pagu", base);
+    } else if (home && *home) {
+        snprintf(dir, sizeof(dir), "%s/%s/pagu", home, journal ? ".local/state" : ".cache");
+    } else {
+        return -1;
+    }
+    *real = realpath(filename, NULL);
+    if (*real == NULL) {
+        return -1;
+    }
+    if (snprintf(out, cap, "%s/%016llx", dir, (unsigned long long)e_fnv64(
+                     *real, strlen(*real), FNV64_INIT)) >= (int)cap) {
+        free(*real);
+        return -1;
+    }
+    return 0;
+}
+
+static void e_file_key(struct e_file_key *key, int fd, struct stat *st) {
+    key->size = st->st_size;
+    key->mtime = st->st_mtim.tv_sec;
+    key->mtime_ns = st->st_mtim.tv_nsec;
+    char block[4096];
+    uint64_t hash = FNV64_INIT;
+    off_t span = st->st_size > (off_t)sizeof(block) ? st->st_size - (off_t)sizeof(block) : 0;
+    for (int i = 0; i < PAGU_SIDECAR_SAMPLES; i++) {
+        ssize_t n = pread(fd, block, sizeof(block), span / (PAGU_SIDECAR_SAMPLES - 1) * i);
+        if (n > 0) {
+            hash = e_fnv64(block, n, hash);
+        }
+        if (span == 0) {
+            break;
+        }
+    }
+    key->sample = hash;
+}
+
+static uint64_t e_sidecar_lex(struct e_syntax *syn) {
+    if (syn == NULL || syn->lex == NULL) {
+        return 0;
+    }
+    struct e_lex *lx = syn->lex;
+    uint64_t h = e_fnv64(lx->cls, sizeof(lx->cls), FNV64_INIT);
+    h = e_fnv64(lx->moves, sizeof(*lx->moves) * lx->n_states * lx->n_cls, h);
+    h = e_fnv64(lx->eol, sizeof(*lx->eol) * lx->n_states, h);
+    return h | 1;
+}
+
+static struct e_sidecar *e_sidecar_map(int fd, struct stat *st, size_t *len) {
+    char path[PATH_MAX];
+    char *real;
+    if (e_sidecar_path(E.buf.filename, 0, path, sizeof(path), &real) == -1) {
+        return NULL;
+    }
+    struct e_sidecar *h = NULL;
+    int sfd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sst;
+    if (sfd != -1 && fstat(sfd, &sst) == 0 && (size_t)sst.st_size >= sizeof(*h)) {
+        h = mmap(NULL, sst.st_size, PROT_READ, MAP_PRIVATE, sfd, 0);
+        *len = sst.st_size;
+        if (h == MAP_FAILED) {
+            h = NULL;
+        }
+    }
+    if (sfd != -1) {
+        close(sfd);
+    }
+    if (h) {
+        struct e_file_key want;
+        e_file_key(&want, fd, st);
+        size_t end = sizeof(*h) + (size_t)h->path_len +
+                     sizeof(struct e_sidecar_row) * (size_t)h->n_rows +
+                     sizeof(uint16_t) * (size_t)h->n_hl;
+        if (memcmp(h->magic, "pagu-ix1", 8) || memcmp(&h->key, &want, sizeof(want)) ||
+            h->n_rows < 0 || h->n_hl < 0 ||
+            h->path_len < 0 || h->path_len % 4 || end > *len ||
+            strncmp((char *)(h + 1), real, h->path_len) ||
+            (size_t)h->path_len <= strlen(real)) {
+            munmap(h, *len);
+            h = NULL;
+        }
+    }
+    free(real);
+    return h;
+}
+
+static int e_sidecar_rows(struct e_sidecar *h, char *map, size_t len) {
+    struct e_sidecar_row *idx = (void *)((char *)(h + 1) + h->path_len);
+    e_row *rows = malloc(sizeof(e_row) * h->n_rows);
+    if (rows == NULL) {
+        return -1;
+    }
+    size_t off = 0;
+    for (int i = 0; i < h->n_rows; i++) {
+        if (idx[i].size > len - off || idx[i].skip > len - off - idx[i].size) {
+            free(rows);
+            return -1;
+        }
+        e_row *row = &rows[i];
+        memset(row, 0, sizeof(e_row));
+        row->chars = map + off;
+        row->size = idx[i].size;
+        row->flags = ROW_MAPPED | ROW_BLOCK;
+        off += (size_t)idx[i].size + idx[i].skip;
+    }
+    if (off != len) {
+        free(rows);
+        return -1;
+    }
+    E.buf.map = map;
+    E.buf.map_len = len;
+    e_open_rows(rows, h->n_rows);
+    return 0;
+}
+
+void e_sidecar_load(int fd, struct stat *st, char *map) {
+    E.buf.disk.on = E.sidecar_min > 0 && st->st_size >= E.sidecar_min;
+    E.buf.disk.indexed = 0;
+    E.buf.disk.dev = st->st_dev;
+    E.buf.disk.ino = st->st_ino;
+    E.buf.disk.size = st->st_size;
+    E.buf.disk.mtime = st->st_mtim;
+    size_t len = 0;
+    struct e_sidecar *h = E.buf.disk.on ? e_sidecar_map(fd, st, &len) : NULL;
+    if (h && h->n_rows > 0 && e_sidecar_rows(h, map, st->st_size) == 0) {
+        E.buf.disk.indexed = 1;
+    } else {
+        e_open_mapped(map, st->st_size);
+    }
+    E.buf.disk.gen = E.buf.gen;
+    if (h == NULL) {
+        return;
+    }
+    if (h->n_hl > 0 && h->n_hl <= E.buf.n_rows && h->lex == e_sidecar_lex(E.buf.syntax)) {
+        uint16_t *hl = (void *)((char *)(h + 1) + h->path_len +
+                                sizeof(struct e_sidecar_row) * h->n_rows);
+        for (int i = 0; i < h->n_hl; i++) {
+            E.buf.row_block[i].hl_state = hl[i];
+        }
+        E.buf.hl_frontier = h->n_hl;
+    }
+    int last = E.buf.n_rows > 0 ? E.buf.n_rows - 1 : 0;
+    E.buf.cy = h->cy < 0 ? 0 : h->cy > last ? last : h->cy;
+    E.buf.row_off = h->row_off < 0 ? 0 : h->row_off > E.buf.cy ? E.buf.cy : h->row_off;
+    e_row *row = e_row_at(E.buf.cy);
+    int size = row ? row->size : 0;
+    E.buf.cx = h->cx < 0 ? 0 : h->cx > size ? size : h->cx;
+    E.buf.col_off = h->col_off < 0 ? 0 : h->col_off;
+    munmap(h, len);
+}
+
+static void e_sidecar_mkdir(char *path) {
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        mkdir(path, 0700);
+        *p = '/';
+    }
+}
+
+void e_sidecar_store(struct e_buffer *b) {
+    if (!b->disk.on || b->filename == NULL) {
+        return;
+    }
+    int fd = open(b->filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    char path[PATH_MAX + 16];
+    char *real;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < E.sidecar_min ||
+        e_sidecar_path(b->filename, 0, path, PATH_MAX, &real) == -1) {
+        close(fd);
+        return;
+    }
+    struct e_sidecar h = {0};
+    memcpy(h.magic, "pagu-ix1", 8);
+    e_file_key(&h.key, fd, &st);
+    close(fd);
+    int same = b->map && b->gen == b->disk.gen && st.st_dev == b->disk.dev &&
+               st.st_ino == b->disk.ino && st.st_size == b->disk.size &&
+               st.st_mtim.tv_sec == b->disk.mtime.tv_sec &&
+               st.st_mtim.tv_nsec == b->disk.mtime.tv_nsec;
+    h.n_rows = same ? b->n_rows : 0;
+    h.lex = same ? e_sidecar_lex(b->syntax) : 0;
+    h.n_hl = h.lex ? b->hl_frontier : 0;
+    h.cx = b->cx;
+    h.cy = b->cy;
+    h.row_off = b->row_off;
+    h.col_off = b->col_off;
+    h.path_len = (strlen(real) + 4) & ~3;
+    size_t at = sizeof(h) + h.path_len + sizeof(struct e_sidecar_row) * h.n_rows;
+
+    uint16_t *hl = malloc(sizeof(uint16_t) * (h.n_hl ? h.n_hl : 1));
+    for (int i = 0; hl && i < h.n_hl; i++) {
+        hl[i] = b->row_block[i].hl_state;
+    }
+    if (hl == NULL) {
+        h.n_hl = 0;
+    }
+    struct iovec iov[2];
+    if (same && b->disk.indexed && (fd = open(path, O_WRONLY | O_CLOEXEC)) != -1) {
+        // states first: until the header says so, the old count still holds
+        iov[0] = (struct iovec){hl, sizeof(uint16_t) * h.n_hl};
+        if (lseek(fd, at, SEEK_SET) != -1 && e_writev_all(fd, iov, 1) == 0 &&
+            ftruncate(fd, at + iov[0].iov_len) == 0) {
+            iov[0] = (struct iovec){&h, sizeof(h)};
+            if (lseek(fd, 0, SEEK_SET) != -1) {
+                e_writev_all(fd, iov, 1);
+            }
+        }
+        close(fd);
+        free(hl);
+        free(real);
+        return;
+    }
+
+    e_sidecar_mkdir(path);
+    char tmp[PATH_MAX + 16];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp) ||
+        (fd = mkstemp(tmp)) == -1) {
+        free(hl);
+        free(real);
+        return;
+    }
+    char *name = calloc(1, h.path_len);
+    memcpy(name, real, strlen(real));
+    iov[0] = (struct iovec){&h, sizeof(h)};
+    iov[1] = (struct iovec){name, h.path_len};
+    int ok = e_writev_all(fd, iov, 2) == 0;
+    struct e_sidecar_row idx[4096];
+    for (int i = 0; ok && i < h.n_rows;) {
+        int n = 0;
+        for (; n < 4096 && i < h.n_rows; n++, i++) {
+            e_row *row = &b->row_block[i];
+            char *next = i + 1 < h.n_rows ? b->row_block[i + 1].chars : b->map + b->map_len;
+            idx[n] = (struct e_sidecar_row){row->size, next - row->chars - row->size};
+        }
+        iov[0] = (struct iovec){idx, sizeof(idx[0]) * n};
+        ok = e_writev_all(fd, iov, 1) == 0;
+    }
+    iov[0] = (struct iovec){hl, sizeof(uint16_t) * h.n_hl};
+    ok = ok && e_writev_all(fd, iov, 1) == 0;
+    if (close(fd) == -1 || !ok || rename(tmp, path) == -1) {
+        unlink(tmp);
+    }
+    free(name);
+    free(hl);
+    free(real);
+}
+
+void e_sidecar_store_all() {
+    e_sidecar_store(&E.buf);
+    for (int i = 0; i < E.n_bufs; i++) {
+        if (i != E.cur_buf) {
+            e_sidecar_store(&E.bufs[i]);
+        }
+    }
+}
+
+// journal
+static long long e_journal_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static size_t e_journal_next(const char *p, size_t len, struct e_journal_rec *rec) {
+    if (len < sizeof(*rec)) {
+        return 0;
+    }
+    memcpy(rec, p, sizeof(*rec));
+    size_t text = rec->op == UNDO_INSERT || rec->op == UNDO_INSERT_ROW ? rec->len : 0;
+    if (rec->op < UNDO_INSERT || rec->op > UNDO_DEL_ROW || rec->len < 0 ||
+        rec->row < 0 || rec->at < 0 || len - sizeof(*rec) < text) {
+        return 0;
+    }
+    return sizeof(*rec) + text;
+}
+
+static int e_journal_replay(const char *p, size_t len) {
+    struct e_journal_rec rec;
+    size_t n;
+    int done = 0;
+    E.buf.journal.on = 0;
+    E.buf.undo.off++;
+    for (; (n = e_journal_next(p, len, &rec)); p += n, len -= n, done++) {
+        const char *text = p + sizeof(rec);
+        e_row *row = e_row_at(rec.row);
+        if (rec.op == UNDO_INSERT_ROW ? rec.row > E.buf.n_rows
+                                      : row == NULL || rec.at > row->size) {
+            break;
+        }
+        switch (rec.op) {
+        case UNDO_INSERT:
+            e_row_insert_str(row, rec.at, text, rec.len);
+            break;
+        case UNDO_DELETE:
+            e_row_delete_str(row, rec.at, rec.len);
+            break;
+        case UNDO_INSERT_ROW:
+            e_insert_row(rec.row, (char *)text, rec.len);
+            break;
+        case UNDO_DEL_ROW:
+            e_del_row(rec.row);
+            break;
+        }
+        E.buf.cy = rec.row < E.buf.n_rows ? rec.row : E.buf.n_rows;
+        E.buf.cx = 0;
+    }
+    E.buf.undo.off--;
+    E.buf.journal.on = 1;
+    return done;
+}
+
+void e_journal_open(int fd) {
+    struct stat st;
+    memset(&E.buf.journal, 0, sizeof(E.buf.journal));
+    E.buf.journal.fd = -1;
+    E.buf.journal.last = -1;
+    if (E.journal_ms <= 0 || E.buf.filename == NULL || fstat(fd, &st) == -1) {
+        return;
+    }
+    e_file_key(&E.buf.journal.key, fd, &st);
+    E.buf.journal.on = 1;
+
+    char path[PATH_MAX + 16];
+    char *real;
+    if (e_sidecar_path(E.buf.filename, 1, path, PATH_MAX, &real) == -1) {
+        return;
+    }
+    int jfd = open(path, O_RDWR | O_CLOEXEC);
+    if (jfd == -1) {
+        free(real);
+        return;
+    }
+    if (flock(jfd, LOCK_EX | LOCK_NB) == -1) {
+        e_set_status_msg("%s is open in another pagu, edits are not journaled",
+                         E.buf.filename);
+        E.buf.journal.on = 0;
+        close(jfd);
+        free(real);
+        return;
+    }
+    struct stat jst;
+    char *data = NULL;
+    size_t len = 0;
+    if (fstat(jfd, &jst) == 0 && (data = malloc(jst.st_size + 1))) {
+        ssize_t n = pread(jfd, data, jst.st_size, 0);
+        len = n > 0 ? n : 0;
+    }
+    struct e_journal_head h;
+    size_t start = 0, end = 0;
+    int n = 0;
+    if (len >= sizeof(h)) {
+        memcpy(&h, data, sizeof(h));
+        start = sizeof(h) + (size_t)h.path_len;
+        if (memcmp(h.magic, "pagu-jn1", 8) || h.path_len <= 0 || start > len ||
+            strncmp(data + sizeof(h), real, h.path_len) ||
+            (size_t)h.path_len <= strlen(real)) {
+            start = 0;
+        }
+    }
+    struct e_journal_rec rec;
+    size_t step;
+    for (end = start; start && (step = e_journal_next(data + end, len - end, &rec)); end += step) {
+        n++;
+    }
+
+    if (n && memcmp(&h.key, &E.buf.journal.key, sizeof(h.key))) {
+        char old[PATH_MAX + 32];
+        snprintf(old, sizeof(old), "%s.old", path);
+        rename(path, old);
+        e_set_status_msg("The journal of %s is for another version of it, moved to %s",
+                         E.buf.filename, old);
+        close(jfd);
+    } else if (n) {
+        E.buf.journal.offer.n = n;
+        E.buf.journal.offer.fd = jfd;
+        E.buf.journal.offer.start = start;
+        E.buf.journal.offer.end = end;
+        E.buf.journal.path = strdup(path);
+        E.buf.journal.on = 0;
+        E.journal_offer = 1;
+    } else {
+        unlink(path);
+        close(jfd);
+    }
+    free(data);
+    free(real);
+}
+
+// asked from the main loop, never while keys come from a feed
+void e_journal_offer() {
+    if (E.feed.on) {
+        return;
+    }
+    E.journal_offer = 0;
+    int from = E.cur_buf;
+    for (int i = 0; i < E.n_bufs; i++) {
+        struct e_buffer *b = i == E.cur_buf ? &E.buf : &E.bufs[i];
+        if (b->journal.offer.n == 0) {
+            continue;
+        }
+        if (i != E.cur_buf) {
+            e_buffer_switch(i);
+        }
+        char prompt[96];
+        snprintf(prompt, sizeof(prompt),
+                 "Recover %d unsaved edits from the journal? (y/n, ESC to keep it) %%s",
+                 E.buf.journal.offer.n);
+        char *answer = e_prompt(prompt, NULL);
+        e_journal_answer(answer);
+        free(answer);
+    }
+    if (E.cur_buf != from) {
+        e_buffer_switch(from);
+    }
+}
+
+void e_journal_answer(const char *answer) {
+    int n = E.buf.journal.offer.n;
+    int jfd = E.buf.journal.offer.fd;
+    if (n == 0) {
+        return;
+    }
+    E.buf.journal.offer.n = 0;
+    if (answer && (*answer == 'y' || *answer == 'Y')) {
+        size_t start = E.buf.journal.offer.start, end = E.buf.journal.offer.end;
+        char *data = malloc(end);
+        int done = 0;
+        if (data && pread(jfd, data, end, 0) == (ssize_t)end) {
+            done = e_journal_replay(data + start, end - start);
+        }
+        free(data);
+        ftruncate(jfd, end);
+        lseek(jfd, end, SEEK_SET);
+        E.buf.journal.fd = jfd;
+        if (done < n) {
+            e_set_status_msg("Recovered %d of %d edits, the rest did not fit", done, n);
+        } else {
+            e_set_status_msg("Recovered %d edits, Ctrl-S to save them", done);
+        }
+        return;
+    }
+    if (answer) {
+        unlink(E.buf.journal.path);
+        E.buf.journal.on = 1;
+    } else {
+        e_set_status_msg("Journal kept, edits are not journaled until %s is reopened",
+                         E.buf.filename);
+    }
+    close(jfd);
+    free(E.buf.journal.path);
+    E.buf.journal.path = NULL;
+}
+
+void e_journal_record(int op, int row, int at, const char *s, int len) {
+    if (!E.buf.journal.on) {
+        return;
+    }
+    struct abuf *ab = &E.buf.journal.pending;
+    struct e_journal_rec rec;
+
+    if (E.buf.journal.last >= 0) {
+        memcpy(&rec, ab->b + E.buf.journal.last, sizeof(rec));
+        if (rec.op == op && rec.row == row && op == UNDO_INSERT && at == rec.at + rec.len) {
+            rec.len += len;
+            memcpy(ab->b + E.buf.journal.last, &rec, sizeof(rec));
+            ab_append(ab, s, len);
+            return;
+        }
+        if (rec.op == op && rec.row == row && op == UNDO_DELETE &&
+            (at == rec.at || at + len == rec.at)) {
+            rec.at = at;
+            rec.len += len;
+            memcpy(ab->b + E.buf.journal.last, &rec, sizeof(rec));
+            return;
+        }
+    }
+    E.buf.journal.last = ab->len;
+    rec = (struct e_journal_rec){op, row, at, len};
+    ab_append(ab, (char *)&rec, sizeof(rec));
+    if (op == UNDO_INSERT || op == UNDO_INSERT_ROW) {
+        ab_append(ab, s, len);
+    }
+    if (E.buf.journal.due == 0) {
+        E.buf.journal.due = e_journal_now() + E.journal_ms;
+    }
+    if (ab->len >= PAGU_JOURNAL_BATCH) {
+        e_journal_flush(&E.buf, 0);
+    }
+}
+
+// made on the first write and locked while open
+static int e_journal_create(struct e_buffer *b) {
+    char path[PATH_MAX + 16];
+    char *real;
+    if (e_sidecar_path(b->filename, 1, path, PATH_MAX, &real) == -1) {
+        return -1;
+    }
+    e_sidecar_mkdir(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    struct e_journal_head h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "pagu-jn1", 8);
+    h.key = b->journal.key;
+    h.path_len = (strlen(real) + 4) & ~3;
+    char *name = calloc(1, h.path_len);
+    memcpy(name, real, strlen(real));
+    struct iovec iov[2] = {{&h, sizeof(h)}, {name, h.path_len}};
+    if (fd != -1 && (ftruncate(fd, 0) == -1 || e_writev_all(fd, iov, 2) == -1)) {
+        unlink(path);
+        close(fd);
+        fd = -1;
+    }
+    free(name);
+    free(real);
+    b->journal.fd = fd;
+    b->journal.path = fd == -1 ? NULL : strdup(path);
+    return fd == -1 ? -1 : 0;
+}
+
+void e_journal_flush(struct e_buffer *b, int sync) {
+    if (!b->journal.on) {
+        return;
+    }
+    struct iovec iov = {b->journal.pending.b, b->journal.pending.len};
+    if (iov.iov_len && ((b->journal.fd == -1 && e_journal_create(b) == -1) ||
+                        e_writev_all(b->journal.fd, &iov, 1) == -1)) {
+        e_set_status_msg("Can't write the journal of %s: %s", b->filename, strerror(errno));
+        e_journal_drop(b);
+        b->journal.on = 0;
+        return;
+    }
+    b->journal.pending.len = 0;
+    b->journal.last = -1;
+    if (sync) {
+        if (b->journal.fd != -1 && E.fsync_policy) {
+            fdatasync(b->journal.fd);
+        }
+        b->journal.due = 0;
+    }
+}
+
+void e_journal_flush_all() {
+    for (int i = 0; i < E.n_bufs; i++) {
+        e_journal_flush(i == E.cur_buf ? &E.buf : &E.bufs[i], 1);
+    }
+}
+
+void e_journal_drop(struct e_buffer *b) {
+    if (b->journal.fd != -1 && b->journal.path) {
+        unlink(b->journal.path);
+        close(b->journal.fd);
+    }
+    if (b->journal.offer.n) {
+        close(b->journal.offer.fd);
+        b->journal.offer.n = 0;
+    }
+    free(b->journal.path);
+    ab_free(&b->journal.pending);
+    b->journal.path = NULL;
+    b->journal.fd = -1;
+    b->journal.last = -1;
+    b->journal.due = 0;
+}
+
+void e_journal_drop_all() {
+    for (int i = 0; i < E.n_bufs; i++) {
+        e_journal_drop(i == E.cur_buf ? &E.buf : &E.bufs[i]);
+    }
+}
+
+void e_journal_saved() {
+    e_journal_drop(&E.buf);
+    int fd = open(E.buf.filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    E.buf.journal.on = E.journal_ms > 0 && fd != -1 && fstat(fd, &st) == 0;
+    if (E.buf.journal.on) {
+        e_file_key(&E.buf.journal.key, fd, &st);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+int e_journal_timeout() {
+    long long due = 0;
+    for (int i = 0; i < E.n_bufs; i++) {
+        struct e_buffer *b = i == E.cur_buf ? &E.buf : &E.bufs[i];
+        if (b->journal.due && (due == 0 || b->journal.due < due)) {
+            due = b->journal.due;
+        }
+    }
+    if (due == 0) {
+        return -1;
+    }
+    long long ms = due - e_journal_now();
+    return ms < 0 ? 0 : ms;
+}
+
+void e_journal_tick() {
+    long long now = e_journal_now();
+    for (int i = 0; i < E.n_bufs; i++) {
+        struct e_buffer *b = i == E.cur_buf ? &E.buf : &E.bufs[i];
+        if (b->journal.due && b->journal.due <= now) {
+            e_journal_flush(b, 1);
+        }
+    }
+}
+
+// regex
+static struct re_node *re_node(struct e_regex *re, int type, int cls,
+                               struct re_node *a, struct re_node *b) {
+    if (re->nnodes == re->nodes_cap) {
+        return NULL;
+    }
+    struct re_node *node = &re->nodes[re->nnodes++];
+    node->type = type;
+    node->cls = cls;
+    node->a = a;
+    node->b = b;
+    return node;
+}
+
+static int re_class(struct e_regex *re) {
+    re->cls = realloc(re->cls, sizeof(*re->cls) * (re->ncls + 1));
+    memset(re->cls[re->ncls], 0, sizeof(*re->cls));
+    return re->ncls++;
+}
+
+static void re_class_range(unsigned char *bits, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) {
+        bits[c >> 3] |= 1 << (c & 7);
+    }
+}
+
+static void re_class_negate(unsigned char *bits) {
+    for (int j = 0; j < 32; j++) {
+        bits[j] = ~bits[j];
+    }
+}
+
+static int re_class_escape(unsigned char *bits, int c) {
+    unsigned char tmp[32] = {0};
+    switch (tolower(c)) {
+    case 'w':
+        re_class_range(tmp, 'a', 'z');
+        re_class_range(tmp, 'A', 'Z');
+        re_class_range(tmp, '0', '9');
+        re_class_range(tmp, '_', '_');
+        break;
+    case 'd':
+        re_class_range(tmp, '0', '9');
+        break;
+    case 's':
+        re_class_range(tmp, '\t', '\r');
+        re_class_range(tmp, ' ', ' ');
+        break;
+    default:
+        return 0;
+    }
+    if (isupper(c)) {
+        re_class_negate(tmp);
+    }
+    for (int j = 0; j < 32; j++) {
+        bits[j] |= tmp[j];
+    }
+    return 1;
+}
+
+static int re_escape_char(int c) {
+    switch (c) {
+    case 't': return '\t';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    default: return c;
+    }
+}
+
+static struct re_node *re_parse_alt(struct e_regex *re);
+
+static struct re_node *re_parse_atom(struct e_regex *re) {
+    const char *p = re->p;
+    int cls;
+    switch (*p) {
+    case '(': {
+        re->p++;
+        struct re_node *node = re_parse_alt(re);
+        if (node == NULL) {
+            return NULL;
+        }
+        if (*re->p != ')') {
+            re->err = "missing )";
+            return NULL;
+        }
+        re->p++;
+        return node;
+    }
+    case '[': {
+        cls = re_class(re);
+        unsigned char *bits = re->cls[cls];
+        p++;
+        int negate = *p == '^';
+        if (negate) p++;
+        // a ] right after [ or [^ is a literal
+        int first = 1;
+        while (*p && (*p != ']' || first)) {
+            first = 0;
+            int lo = (unsigned char)*p++;
+            if (lo == '\\' && *p) {
+                if (re_class_escape(bits, *p)) {
+                    p++;
+                    continue;
+                }
+                lo = re_escape_char((unsigned char)*p++);
+            }
+            int hi = lo;
+            if (p[0] == '-' && p[1] && p[1] != ']') {
+                p++;
+                hi = (unsigned char)*p++;
+                if (hi == '\\' && *p) {
+                    hi = re_escape_char((unsigned char)*p++);
+                }
+            }
+            if (lo <= hi) {
+                re_class_range(bits, lo, hi);
+            }
+        }
+        if (*p != ']') {
+            re->err = "missing ]";
+            return NULL;
+        }
+        if (negate) {
+            re_class_negate(bits);
+        }
+        re->p = p + 1;
+        return re_node(re, RE_CHAR, cls, NULL, NULL);
+    }
+    case '.':
+        re->p++;
+        cls = re_class(re);
+        re_class_range(re->cls[cls], 0, 255);
+        return re_node(re, RE_CHAR, cls, NULL, NULL);
+    case '^':
+        re->p++;
+        return re_node(re, RE_BOL, 0, NULL, NULL);
+    case '$':
+        re->p++;
+        return re_node(re, RE_EOL, 0, NULL, NULL);
+    case '*':
+    case '+':
+    case '?':
+        re->err = "nothing to repeat";
+        return NULL;
+    case '\\':
+        if (p[1] == '\0') {
+            re->err = "trailing \\";
+            return NULL;
+        }
+        re->p += 2;
+        cls = re_class(re);
+        if (!re_class_escape(re->cls[cls], p[1])) {
+            int c = re_escape_char((unsigned char)p[1]);
+            re_class_range(re->cls[cls], c, c);
+        }
+        return re_node(re, RE_CHAR, cls, NULL, NULL);
+    default:
+        re->p++;
+        cls = re_class(re);
+        re_class_range(re->cls[cls], (unsigned char)*p, (unsigned char)*p);
+        return re_node(re, RE_CHAR, cls, NULL, NULL);
+    }
+}
+
+static struct re_node *re_parse_cat(struct e_regex *re) {
+    struct re_node *node = re_node(re, RE_EMPTY, 0, NULL, NULL);
+    while (node && *re->p && *re->p != '|' && *re->p != ')') {
+        struct re_node *atom = re_parse_atom(re);
+        while (atom && (*re->p == '*' || *re->p == '+' || *re->p == '?')) {
+            int type = *re->p == '*' ? RE_STAR : *re->p == '+' ? RE_PLUS : RE_QUEST;
+            re->p++;
+            atom = re_node(re, type, 0, atom, NULL);
+        }
+        if (atom == NULL) {
+            return NULL;
+        }
+        node = node->type == RE_EMPTY ? atom : re_node(re, RE_CAT, 0, node, atom);
+    }
+    return node;
+}
+
+static struct re_node *re_parse_alt(struct e_regex *re) {
+    struct re_node *node = re_parse_cat(re);
+    while (node && *re->p == '|') {
+        re->p++;
+        struct re_node *rhs = re_parse_cat(re);
+        node = rhs ? re_node(re, RE_ALT, 0, node, rhs) : NULL;
+    }
+    return node;
+}
+
+static int re_nfa_add(struct e_regex *re, int op, int out, int out1, int cls) {
+    if (re->nn == re->ncap) {
+        re->ncap = re->ncap ? re->ncap * 2 : 64;
+        re->nfa = realloc(re->nfa, sizeof(struct re_nstate) * re->ncap);
+    }
+    re->nfa[re->nn] = (struct re_nstate){op, out, out1, cls};
+    return re->nn++;
+}
+
+// builds the NFA back to front
+static int re_compile_node(struct e_regex *re, struct re_node *node, int next,
+                           int reverse) {
+    switch (node->type) {
+    case RE_CHAR:
+        return re_nfa_add(re, RE_SET, next, -1, node->cls);
+    case RE_CAT:
+        if (reverse) {
+            return re_compile_node(re, node->b,
+                                   re_compile_node(re, node->a, next, reverse),
+                                   reverse);
+        }
+        return re_compile_node(re, node->a,
+                               re_compile_node(re, node->b, next, reverse),
+                               reverse);
+    case RE_ALT: {
+        int a = re_compile_node(re, node->a, next, reverse);
+        int b = re_compile_node(re, node->b, next, reverse);
+        return re_nfa_add(re, RE_SPLIT, a, b, 0);
+    }
+    case RE_STAR:
+    case RE_PLUS: {
+        int s = re_nfa_add(re, RE_SPLIT, -1, next, 0);
+        int body = re_compile_node(re, node->a, s, reverse);
+        re->nfa[s].out = body;
+        return node->type == RE_STAR ? s : body;
+    }
+    case RE_QUEST:
+        return re_nfa_add(re, RE_SPLIT,
+                          re_compile_node(re, node->a, next, reverse), next, 0);
+    case RE_BOL:
+        return re_nfa_add(re, reverse ? RE_AT_END : RE_AT_START, next, -1, 0);
+    case RE_EOL:
+        return re_nfa_add(re, reverse ? RE_AT_START : RE_AT_END, next, -1, 0);
+    default:
+        return next;
+    }
+}
+
+static void re_closure(struct e_regex *re, int s, int at_start, int at_end) {
+    int sp = 0;
+    re->stack[sp++] = s;
+    while (sp) {
+        s = re->stack[--sp];
+        if (re->mark[s] == re->gen) {
+            continue;
+        }
+        re->mark[s] = re->gen;
+        struct re_nstate *st = &re->nfa[s];
+        switch (st->op) {
+        case RE_SPLIT:
+            re->stack[sp++] = st->out1;
+            re->stack[sp++] = st->out;
+            break;
+        case RE_AT_START:
+            if (at_start) {
+                re->stack[sp++] = st->out;
             }
-            i++;
+            break;
+        case RE_AT_END:
+            if (at_end) {
+                re->stack[sp++] = st->out;
+            } else {
+                re->set[re->nset++] = s;
+            }
+            break;
+        default:
+            re->set[re->nset++] = s;
         }
     }
 }
 
-// row operations
-void e_insert_row(int at, char *s, size_t len) {
-    if (at < 0 || at > E.n_rows) {
+static int re_cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static void re_dfa_reset(struct re_dfa *d) {
+    for (int j = 0; j < d->n; j++) {
+        free(d->states[j]->set);
+        free(d->states[j]);
+    }
+    d->n = 0;
+    d->resets++;
+    memset(d->table, -1, sizeof(int) * PAGU_RE_STATES * 2);
+    memset(d->trans, -1, sizeof(int) * PAGU_RE_STATES * 256);
+    d->init[0] = d->init[1] = -1;
+}
+
+static int re_dfa_state(struct e_regex *re, struct re_dfa *d) {
+    qsort(re->set, re->nset, sizeof(int), re_cmp_int);
+    uint32_t h = 2166136261u;
+    for (int j = 0; j < re->nset; j++) {
+        h = (h ^ re->set[j]) * 16777619u;
+    }
+    uint32_t mask = PAGU_RE_STATES * 2 - 1;
+    uint32_t i = h & mask;
+    for (; d->table[i] != -1; i = (i + 1) & mask) {
+        struct re_dstate *ds = d->states[d->table[i]];
+        if (ds->hash == h && ds->n == re->nset &&
+            !memcmp(ds->set, re->set, sizeof(int) * re->nset)) {
+            return d->table[i];
+        }
+    }
+    if (d->n == PAGU_RE_STATES) {
+        re_dfa_reset(d);
+        return re_dfa_state(re, d);
+    }
+
+    struct re_dstate *ds = malloc(sizeof(struct re_dstate));
+    ds->n = re->nset;
+    ds->set = malloc(sizeof(int) * (re->nset ? re->nset : 1));
+    memcpy(ds->set, re->set, sizeof(int) * re->nset);
+    ds->hash = h;
+    int accept = re->nset == 0 ? RE_DEAD : 0;
+    for (int j = 0; j < re->nset; j++) {
+        if (re->nfa[re->set[j]].op == RE_MATCH) {
+            accept |= RE_ACCEPT;
+        }
+    }
+    int saved = re->nset;
+    re->gen++;
+    re->nset = 0;
+    for (int j = 0; j < ds->n; j++) {
+        re_closure(re, ds->set[j], 0, 1);
+    }
+    for (int j = 0; j < re->nset; j++) {
+        if (re->nfa[re->set[j]].op == RE_MATCH) {
+            accept |= RE_ACCEPT_END;
+        }
+    }
+    re->nset = saved;
+    memcpy(re->set, ds->set, sizeof(int) * ds->n);
+
+    d->states[d->n] = ds;
+    d->accept[d->n] = accept;
+    d->table[i] = d->n;
+    return d->n++;
+}
+
+static int re_dfa_start(struct e_regex *re, struct re_dfa *d, int at_start) {
+    if (d->init[at_start] == -1) {
+        re->gen++;
+        re->nset = 0;
+        re_closure(re, d->start, at_start, 0);
+        d->init[at_start] = re_dfa_state(re, d);
+    }
+    return d->init[at_start];
+}
+
+static int re_dfa_next(struct e_regex *re, struct re_dfa *d, int s,
+                       unsigned char c) {
+    struct re_dstate *ds = d->states[s];
+    re->gen++;
+    re->nset = 0;
+    for (int j = 0; j < ds->n; j++) {
+        struct re_nstate *st = &re->nfa[ds->set[j]];
+        if (st->op == RE_SET && (re->cls[st->cls][c >> 3] & (1 << (c & 7)))) {
+            re_closure(re, st->out, 0, 0);
+        }
+    }
+    if (d->unanchored) {
+        re_closure(re, d->start, 0, 0);
+    }
+    int resets = d->resets;
+    int t = re_dfa_state(re, d);
+    if (d->resets == resets) {
+        d->trans[s * 256 + c] = t;
+    }
+    return t;
+}
+
+static void re_dfa_init(struct re_dfa *d, int start, int unanchored) {
+    d->start = start;
+    d->unanchored = unanchored;
+    d->states = malloc(sizeof(struct re_dstate *) * PAGU_RE_STATES);
+    d->table = malloc(sizeof(int) * PAGU_RE_STATES * 2);
+    d->trans = malloc(sizeof(int) * PAGU_RE_STATES * 256);
+    d->accept = malloc(PAGU_RE_STATES);
+    d->n = 0;
+    re_dfa_reset(d);
+}
+
+void e_re_free(struct e_regex *re) {
+    if (re == NULL) {
         return;
     }
-    E.row = realloc(E.row, sizeof(e_row) * (E.n_rows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(e_row) * (E.n_rows - at));
-    for (int j = at + 1; j <= E.n_rows; j++) E.row[j].idx++;
+    struct re_dfa *dfas[2] = {&re->fwd, &re->rev};
+    for (int j = 0; j < 2; j++) {
+        re_dfa_reset(dfas[j]);
+        free(dfas[j]->states);
+        free(dfas[j]->table);
+        free(dfas[j]->trans);
+        free(dfas[j]->accept);
+    }
+    free(re->nodes);
+    free(re->cls);
+    free(re->nfa);
+    free(re->stack);
+    free(re->mark);
+    free(re->set);
+    free(re->starts);
+    free(re->memo_st);
+    free(re->memo_end);
+    free(re->walk_at);
+    free(re->walk_st);
+    free(re);
+}
 
-    E.row[at].idx = at;
+struct e_regex *e_re_compile(const char *pattern, const char **err) {
+    struct e_regex *re = calloc(1, sizeof(struct e_regex));
+    re->nodes_cap = 3 * strlen(pattern) + 4;
+    re->nodes = malloc(sizeof(struct re_node) * re->nodes_cap);
+    re->p = pattern;
+    struct re_node *root = re_parse_alt(re);
+    if (root && *re->p == ')') {
+        re->err = "unmatched )";
+    }
+    if (re->err || root == NULL) {
+        *err = re->err ? re->err : "bad pattern";
+        free(re->nodes);
+        free(re->cls);
+        free(re);
+        return NULL;
+    }
 
-    E.row = realloc(E.row, sizeof(e_row) * (E.n_rows + 1));
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+    int match = re_nfa_add(re, RE_MATCH, -1, -1, 0);
+    int fwd = re_compile_node(re, root, match, 0);
+    int rev = re_compile_node(re, root, match, 1);
+    re->stack = malloc(sizeof(int) * (2 * re->nn + 2));
+    re->mark = calloc(re->nn, sizeof(uint32_t));
+    re->set = malloc(sizeof(int) * re->nn);
+    re_dfa_init(&re->fwd, fwd, 0);
+    re_dfa_init(&re->rev, rev, 1);
 
-    E.row[at].r_size = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-    e_update_row(&E.row[at]);
+    re->gen++;
+    re->nset = 0;
+    re_closure(re, rev, 0, 0);
+    re->can_skip = 1;
+    for (int j = 0; j < re->nset; j++) {
+        struct re_nstate *st = &re->nfa[re->set[j]];
+        if (st->op == RE_MATCH) {
+            re->can_skip = 0;
+        } else if (st->op == RE_SET) {
+            for (int c = 0; c < 256; c++) {
+                re->ends[c] |= (re->cls[st->cls][c >> 3] >> (c & 7)) & 1;
+            }
+        }
+    }
+    re->end_byte = -1;
+    int n = 0;
+    for (int c = 0; c < 256; c++) {
+        if (re->ends[c]) {
+            re->end_byte = c;
+            n++;
+        }
+    }
+    if (n != 1) {
+        re->end_byte = -1;
+    }
+    return re;
+}
 
-    E.n_rows++;
-    E.dirty++;
+// end of the longest match from at, -1 if none; memoised at checkpoints
+static int re_longest(struct e_regex *re, const char *s, int len, int at) {
+    struct re_dfa *d = &re->fwd;
+    int n = len / PAGU_RE_MEMO + 1;
+    if (n > re->memo_cap) {
+        re->memo_cap = n;
+        re->memo_st = realloc(re->memo_st, sizeof(int) * n);
+        re->memo_end = realloc(re->memo_end, sizeof(int) * n);
+        re->walk_at = realloc(re->walk_at, sizeof(int) * n);
+        re->walk_st = realloc(re->walk_st, sizeof(int) * n);
+        re->memo_resets = -1;
+    }
+    int st = re_dfa_start(re, d, at == 0);
+    int best = -1, end = -1, nwalk = 0;
+    for (int i = at;; i++) {
+        if (i % PAGU_RE_MEMO == 0) {
+            if (re->memo_resets != d->resets) {
+                memset(re->memo_st, -1, sizeof(int) * n);
+                re->memo_resets = d->resets;
+                nwalk = 0;
+            }
+            int k = i / PAGU_RE_MEMO;
+            if (re->memo_st[k] == st) {
+                end = re->memo_end[k];
+                break;
+            }
+            if (re->memo_st[k] == -1) {
+                re->walk_at[nwalk] = i;
+                re->walk_st[nwalk++] = st;
+            }
+        }
+        if (i == len) {
+            if (d->accept[st] & RE_ACCEPT_END) {
+                end = len;
+            }
+            break;
+        }
+        unsigned char c = s[i];
+        int t = d->trans[st * 256 + c];
+        st = t != -1 ? t : re_dfa_next(re, d, st, c);
+        if (d->accept[st] & RE_DEAD) {
+            break;
+        }
+        if (d->accept[st] & RE_ACCEPT) {
+            best = i + 1;
+        }
+    }
+    if (re->memo_resets == d->resets) {
+        for (int j = 0; j < nwalk; j++) {
+            int k = re->walk_at[j] / PAGU_RE_MEMO;
+            re->memo_st[k] = re->walk_st[j];
+            re->memo_end[k] =
+                end != -1 ? end : best > re->walk_at[j] ? best : -1;
+        }
+    }
+    return end != -1 ? end : best;
 }
 
-void e_update_row(e_row *row) {
-    int tabs = 0;
-    int j;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            tabs++;
-        }
-    }
-    free(row->render);
-    row->render = malloc(row->size + tabs * (PAGU_TAB_STOP - 1) + 1);
-    int idx = 0;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % PAGU_TAB_STOP != 0) {
-                row->render[idx++] = ' ';
+// leftmost-longest match in s[from, len), -1 if none
+int e_re_find(struct e_regex *re, const char *s, int len, int from, int *mlen) {
+    if (from == 0 || re->starts_for != s || re->starts_len != len) {
+        if (len + 1 > re->starts_cap) {
+            re->starts_cap = len + 1;
+            re->starts = realloc(re->starts, re->starts_cap);
+        }
+        struct re_dfa *d = &re->rev;
+        int resets = d->resets;
+        int idle = re->can_skip ? re_dfa_start(re, d, 0) : -1;
+        int st = re_dfa_start(re, d, 1);
+        if (d->resets != resets) {
+            idle = -1;
+        }
+        int any = 0;
+        re->starts[len] = 0; // an empty match is no match
+        for (int i = len - 1; i >= 0; i--) {
+            if (st == idle) {
+                int j = i;
+                if (re->end_byte != -1) {
+                    const char *p = memrchr(s, re->end_byte, i + 1);
+                    j = p ? p - s : -1;
+                } else {
+                    while (j >= 0 && !re->ends[(unsigned char)s[j]]) j--;
+                }
+                memset(&re->starts[j + 1], 0, i - j);
+                if ((i = j) < 0) {
+                    break;
+                }
             }
-        } else {
-            row->render[idx++] = row->chars[j];
+            unsigned char c = s[i];
+            int t = d->trans[st * 256 + c];
+            if (t == -1) {
+                t = re_dfa_next(re, d, st, c);
+                if (d->resets != resets) {
+                    idle = -1;
+                }
+            }
+            st = t;
+            re->starts[i] = d->accept[st] & RE_ACCEPT;
+            any |= re->starts[i];
+        }
+        if (len > 0) {
+            re->starts[0] = d->accept[st] & (RE_ACCEPT | RE_ACCEPT_END);
+            any |= re->starts[0];
+        }
+        re->starts_for = any ? s : NULL;
+        re->starts_len = len;
+        re->memo_resets = -1;
+        if (!any) {
+            return -1;
         }
     }
-    row->render[idx] = '\0';
-    row->r_size = idx;
 
-    e_update_syntax(row);
+    for (int at = from; at < len; at++) {
+        if (!re->starts[at]) {
+            continue;
+        }
+        int best = re_longest(re, s, len, at);
+        if (best > at) {
+            *mlen = best - at;
+            return at;
+        }
+    }
+    return -1;
 }
 
-int e_cxrx(e_row *row, int cx) {
-    int rx = 0;
-    for (int i = 0; i < cx; i++) {
-        if (row->chars[i] == '\t') {
-            rx += (PAGU_TAB_STOP - 1) - (rx % PAGU_TAB_STOP);
+// find
+static int e_find_scalar(const char *s, int len, const char *q, int qlen) {
+    const char *p = s;
+    const char *end = s + len - qlen + 1;
+    while (p < end && (p = memchr(p, q[0], end - p))) {
+        if (p[qlen - 1] == q[qlen - 1] && !memcmp(p, q, qlen)) {
+            return p - s;
         }
-        rx++;
+        p++;
     }
-    return rx;
+    return -1;
 }
 
-int e_rxcx(e_row *row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t') {
-            cur_rx += (PAGU_TAB_STOP - 1) - (cur_rx % PAGU_TAB_STOP);
+#if defined(__x86_64__)
+static int e_find_sse2(const char *s, int len, const char *q, int qlen) {
+    __m128i first = _mm_set1_epi8(q[0]);
+    __m128i last = _mm_set1_epi8(q[qlen - 1]);
+    int i = 0;
+    for (; i + qlen - 1 + 16 <= len; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i bl = _mm_loadu_si128((const __m128i *)(s + i + qlen - 1));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(s + i + bit, q, qlen)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
         }
-        cur_rx++;
-        if (cur_rx > rx) {
-            return cx;
+    }
+    int r = e_find_scalar(s + i, len - i, q, qlen);
+    return r == -1 ? -1 : i + r;
+}
+
+__attribute__((target("avx2")))
+static int e_find_avx2(const char *s, int len, const char *q, int qlen) {
+    __m256i first = _mm256_set1_epi8(q[0]);
+    __m256i last = _mm256_set1_epi8(q[qlen - 1]);
+    int i = 0;
+    for (; i + qlen - 1 + 32 <= len; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i *)(s + i + qlen - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(s + i + bit, q, qlen)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
         }
     }
-    return cx;
+    int r = e_find_scalar(s + i, len - i, q, qlen);
+    return r == -1 ? -1 : i + r;
 }
+#endif
 
-void e_row_insert_char(e_row *row, int at, int c) {
-    if (at < 0 || at > row->size) {
-        at = row->size;
+struct e_find_impl {
+    const char *name;
+    int (*fn)(const char *, int, const char *, int);
+    int (*supported)(void);
+};
+
+static int e_cpu_any() { return 1; }
+#if defined(__x86_64__)
+static int e_cpu_avx2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+static struct e_find_impl e_find_impls[] = {
+#if defined(__x86_64__)
+    {"avx2", e_find_avx2, e_cpu_avx2},
+    {"sse2", e_find_sse2, e_cpu_any},
+#endif
+    {"scalar", e_find_scalar, e_cpu_any},
+};
+
+int e_find_in(const char *s, int len, const char *q, int qlen) {
+    static int (*fn)(const char *, int, const char *, int);
+    if (fn == NULL) {
+        unsigned int j = 0;
+        while (!e_find_impls[j].supported()) j++;
+        fn = e_find_impls[j].fn;
     }
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    e_update_row(row);
-    E.dirty++;
+    if (qlen > len) {
+        return -1;
+    }
+    if (qlen == 1 || len < 64) {
+        return e_find_scalar(s, len, q, qlen);
+    }
+    return fn(s, len, q, qlen);
 }
 
-void e_row_delete_char(e_row *row, int at) {
-    if (at < 0 || at >= row->size) {
-        return;
+static void e_find_push(struct e_find_job *job, int row, int col, int len) {
+    if (job->n == job->cap) {
+        job->cap = job->cap ? job->cap * 2 : 256;
+        job->m = realloc(job->m, sizeof(struct e_match) * job->cap);
     }
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    e_update_row(row);
-    E.dirty++;
+    job->m[job->n].row = row;
+    job->m[job->n].col = col;
+    job->m[job->n].len = len;
+    job->n++;
 }
 
-void e_free_row(e_row *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+static void e_find_push_all(struct e_find_job *job, const char *s, int len, int base) {
+    int col = 0, k;
+    while ((k = e_find_in(&s[col], len - col, job->query, job->qlen)) != -1) {
+        e_find_push(job, job->idx, base + col + k, job->qlen);
+        col += k + 1;
+    }
 }
 
-void e_del_row(int at) {
-    if (at < 0 || at >= E.n_rows) {
+static void e_find_segs(struct e_find_job *job, e_row *row) {
+    struct e_segs *g = row->segs;
+    int qlen = job->qlen;
+    if (qlen > 1 && 2 * qlen > job->text_cap) {
+        job->text_cap = 2 * qlen;
+        free(job->text);
+        job->text = malloc(job->text_cap);
+    }
+    int at = 0;
+    for (int i = 0; i < g->n; at += g->seg[i++]->len) {
+        int end = at + g->seg[i]->len;
+        e_find_push_all(job, g->seg[i]->data, g->seg[i]->len, at);
+        if (qlen > 1 && end < row->size) {
+            int from = end - (qlen - 1) > at ? end - (qlen - 1) : at;
+            int to = end + (qlen - 1) < row->size ? end + (qlen - 1) : row->size;
+            e_row_copy(row, from, to - from, job->text);
+            int col = 0, k;
+            while (col < end - from &&
+                   (k = e_find_in(&job->text[col], to - from - col, job->query, qlen)) != -1 &&
+                   from + col + k < end) {
+                e_find_push(job, job->idx, from + col + k, qlen);
+                col += k + 1;
+            }
+        }
+    }
+}
+
+static int e_find_rows(struct e_find_job *job, int max_rows) {
+    e_row *row = job->row;
+    for (; row && max_rows--; row = e_row_next(row), job->idx++) {
+        if (!job->re) {
+            if (row->flags & ROW_CHUNKED) {
+                e_find_segs(job, row);
+            } else {
+                e_find_push_all(job, row->chars, row->size, 0);
+            }
+            continue;
+        }
+        int col = 0;
+        int k, len;
+        const char *chars = e_row_text(row, &job->text, &job->text_cap);
+        while ((k = e_re_find(job->re, chars, row->size, col, &len)) != -1) {
+            e_find_push(job, job->idx, k, len);
+            col = k + len;
+        }
+    }
+    job->row = row;
+    return row == NULL;
+}
+
+static void e_find_job_free(struct e_find_job *job) {
+    e_re_free(job->re);
+    free(job->text);
+    free(job->query);
+    free(job->m);
+    free(job);
+}
+
+static void e_find_publish(struct e_find_job *job) {
+    free(E.buf.find.m);
+    E.buf.find.m = job->m;
+    E.buf.find.n = job->n;
+    E.buf.find.cap = job->cap;
+    free(E.buf.find.query);
+    E.buf.find.query = job->query;
+    E.buf.find.qlen = job->qlen;
+    job->m = NULL;
+    job->query = NULL;
+    e_find_job_free(job);
+}
+
+// when q extends the previous query only its matches are rechecked
+void e_find_scan(const char *q, int qlen) {
+    int narrow = E.buf.find.query && E.buf.find.qlen > 0 && qlen >= E.buf.find.qlen &&
+                 !memcmp(q, E.buf.find.query, E.buf.find.qlen);
+    E.buf.find.error = NULL;
+    E.buf.find.seq++; // a scan still running for an older query is stale now
+    E.buf.find.pending = 0;
+    E.buf.find.ready = 0;
+    if (qlen == 0) {
+        E.buf.find.n = 0;
+    } else if (!E.buf.find.regex && narrow) {
+        int n = 0;
+        int at = -1;
+        e_row *row = NULL;
+        for (int i = 0; i < E.buf.find.n; i++) {
+            struct e_match m = E.buf.find.m[i];
+            if (m.row != at) {
+                row = row && m.row == at + 1 ? e_row_next(row) : e_row_at(m.row);
+                at = m.row;
+            }
+            if (m.col + qlen <= row->size &&
+                !e_row_cmp(row, m.col, q, qlen)) {
+                m.len = qlen;
+                E.buf.find.m[n++] = m;
+            }
+        }
+        E.buf.find.n = n;
+    } else {
+        struct e_find_job *job = calloc(1, sizeof(struct e_find_job));
+        if (E.buf.find.regex && !(job->re = e_re_compile(q, &E.buf.find.error))) {
+            free(job);
+            E.buf.find.n = 0;
+            return;
+        }
+        job->query = strndup(q, qlen);
+        job->qlen = qlen;
+        job->row = e_row_at(0);
+        job->gen = E.buf.gen;
+        job->seq = E.buf.find.seq;
+        if (E.buf.n_rows > PAGU_SYNC_ROWS && e_worker_submit(job)) {
+            E.buf.find.n = 0;
+            E.buf.find.pending = 1;
+            free(E.buf.find.query);
+            E.buf.find.query = NULL;
+            E.buf.find.qlen = qlen;
+            return;
+        }
+        e_find_rows(job, E.buf.n_rows);
+        e_find_publish(job);
         return;
     }
-    e_free_row(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(e_row) * (E.n_rows - at - 1));
-    for (int j = at; j < E.n_rows - 1; j++) E.row[j].idx--;
-    E.n_rows--;
-    E.dirty++;
+    free(E.buf.find.query);
+    E.buf.find.query = strndup(q, qlen);
+    E.buf.find.qlen = qlen;
 }
 
-void e_row_append_str(e_row *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    e_update_row(row);
-    E.dirty++;
+// the first n rows went off the front of a ring
+void e_find_drop(int n) {
+    if (n == 0) {
+        return;
+    }
+    int k = 0;
+    while (k < E.buf.find.n && E.buf.find.m[k].row < n) k++;
+    E.buf.find.n -= k;
+    if (k) {
+        memmove(E.buf.find.m, &E.buf.find.m[k], sizeof(struct e_match) * E.buf.find.n);
+    }
+    for (int i = 0; i < E.buf.find.n; i++) {
+        E.buf.find.m[i].row -= n;
+    }
+    E.buf.find.cur = E.buf.find.cur > k ? E.buf.find.cur - k : 0;
+    E.buf.find.from_row = E.buf.find.from_row > n ? E.buf.find.from_row - n : 0;
+    E.buf.find.hl_row -= n;
 }
 
-// editor operations
-void e_insert_char(int c) {
-    if (E.cy == E.n_rows) {
-        e_insert_row(E.n_rows, "", 0);
+static void e_find_first() {
+    int lo = 0, hi = E.buf.find.n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct e_match m = E.buf.find.m[mid];
+        if (m.row < E.buf.find.from_row ||
+            (m.row == E.buf.find.from_row && m.col < E.buf.find.from_col)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
-    e_row_insert_char(&E.row[E.cy], E.cx, c);
-    E.cx++;
+    E.buf.find.cur = lo < E.buf.find.n ? lo : 0;
 }
 
-void e_delete_char() {
-    if (E.cy == E.n_rows || (E.cx == 0 && E.cy == 0)) {
+void e_find_cb(char *query, int key) {
+    static char *saved_hl = NULL;
+    if (key == JOB_KEY && !E.buf.find.ready) {
         return;
     }
+    if (saved_hl) {
+        e_row *row = e_row_at(E.buf.find.hl_row);
+        if (row && (row->flags & ROW_CHUNKED)) {
+            e_cache_evict(row);
+            row->flags |= ROW_DAMAGED;
+        } else if (row && row->hl) {
+            memcpy(row->hl, saved_hl, row->size);
+            row->flags |= ROW_DAMAGED;
+        }
+        free(saved_hl);
+        saved_hl = NULL;
+    }
 
-    if (E.cx > 0) {
-        e_row_delete_char(&E.row[E.cy], E.cx - 1);
-        E.cx--;
+    if (key == '\r' || key == '\x1b') {
+        E.buf.find.active = 0;
+        E.buf.find.n = 0;
+        free(E.buf.find.query);
+        E.buf.find.query = NULL;
+        E.buf.find.qlen = 0;
+        E.buf.find.seq++;
+        E.buf.find.pending = 0;
+        return;
+    } else if (key == JOB_KEY) {
+        E.buf.find.ready = 0;
+        e_find_first();
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        if (E.buf.find.n) {
+            E.buf.find.cur = (E.buf.find.cur + 1) % E.buf.find.n;
+        }
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        if (E.buf.find.n) {
+            E.buf.find.cur = (E.buf.find.cur + E.buf.find.n - 1) % E.buf.find.n;
+        }
     } else {
-        E.cx = E.row[E.cy - 1].size;
-        e_row_append_str(&E.row[E.cy - 1], (&E.row[E.cy])->chars,
-                         (&E.row[E.cy])->size);
-        e_del_row(E.cy);
-        E.cy--;
+        if (key == CTRL_KEY('r')) {
+            E.buf.find.regex = !E.buf.find.regex;
+            free(E.buf.find.query);
+            E.buf.find.query = NULL;
+        }
+        e_find_scan(query, strlen(query));
+        e_find_first();
+    }
+    if (E.buf.find.n == 0) {
+        return;
+    }
+
+    struct e_match m = E.buf.find.m[E.buf.find.cur];
+    e_row *row = e_row_at(m.row);
+    E.buf.cy = m.row;
+    E.buf.cx = m.col;
+    E.buf.row_off = E.buf.n_rows;
+
+    e_row_render(row);
+    int hl_at = 0;
+    if (row->flags & ROW_CHUNKED) {
+        e_row_window(row, m.col, m.len);
+        hl_at = row->segs->hl_at;
     }
+    E.buf.find.hl_row = m.row;
+    saved_hl = malloc(e_row_hl_len(row) + 1);
+    memcpy(saved_hl, row->hl, e_row_hl_len(row));
+    memset(&row->hl[m.col - hl_at], HL_MATCH, m.len);
+    row->flags |= ROW_DAMAGED;
 }
 
-void e_insert_newline() {
-    if (E.cx == 0) {
-        e_insert_row(E.cy, "", 0);
+void e_find() {
+    int saved_cx = E.buf.cx;
+    int saved_cy = E.buf.cy;
+    int saved_coloff = E.buf.col_off;
+    int saved_rowoff = E.buf.row_off;
+
+    E.buf.find.active = 1;
+    E.buf.find.from_row = E.buf.cy;
+    E.buf.find.from_col = E.buf.cx;
+    char *query = e_prompt("Search: %s (Use ESC/Arrows/Enter, Ctrl-R regex)",
+                           e_find_cb);
+
+    if (query) {
+        free(query);
     } else {
-        e_row *row = &E.row[E.cy];
-        e_insert_row(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        e_update_row(row);
+        E.buf.cx = saved_cx;
+        E.buf.cy = saved_cy;
+        E.buf.col_off = saved_coloff;
+        E.buf.row_off = saved_rowoff;
     }
-    E.cy++;
-    E.cx = 0;
 }
 
-// file IO
-void e_open(char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
+// worker
+static int e_worker_hl_target() {
+    int to = E.buf.row_off + E.screen_rows;
+    return to < E.buf.n_rows ? to : E.buf.n_rows;
+}
 
-    e_select_hl();
+static int e_worker_has_work() {
+    return E.worker.search || (E.buf.syntax && E.buf.hl_frontier < e_worker_hl_target());
+}
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        die("fopen");
-    }
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 &&
-               (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
-            linelen--;
+static void e_worker_step() {
+    struct e_find_job *job = E.worker.search;
+    if (job) {
+        if (job->seq != E.buf.find.seq || job->gen != E.buf.gen) {
+            E.worker.search = NULL;
+            e_find_job_free(job);
+        } else if (e_find_rows(job, PAGU_JOB_ROWS)) {
+            E.worker.search = NULL;
+            e_find_publish(job);
+            E.buf.find.pending = 0;
+            E.buf.find.ready = 1;
+            e_worker_wake_main();
         }
-        e_insert_row(E.n_rows, line, linelen);
+        return;
     }
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
-}
-
-char *e_rows_to_string(int *buflen) {
-    int tot_len = 0;
-    int j;
-    for (j = 0; j < E.n_rows; j++) {
-        tot_len += E.row[j].size + 1;
-    }
-    *buflen = tot_len;
-    char *buf = malloc(tot_len);
-    char *p = buf;
-    for (j = 0; j < E.n_rows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+    int to = E.buf.hl_frontier + PAGU_JOB_ROWS;
+    if (to > e_worker_hl_target()) {
+        to = e_worker_hl_target();
+    }
+    E.hl_redraw = 0;
+    e_syntax_sync(to);
+    if (E.hl_redraw) {
+        e_worker_wake_main();
     }
-    return buf;
 }
 
-void e_save() {
-    if (E.filename == NULL) {
-        E.filename = e_prompt("Save as: %s (ESC to abort)", NULL);
-        if (E.filename == NULL) {
-            e_set_status_msg("Save aborted");
-            return;
+static void *e_worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&E.worker.lock);
+    for (;;) {
+        while (!atomic_load(&E.worker.main_waiting) || !e_worker_has_work()) {
+            pthread_cond_wait(&E.worker.cond, &E.worker.lock);
         }
-        e_select_hl();
+        e_worker_step();
     }
-    int len;
-    char *buf = e_rows_to_string(&len);
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                e_set_status_msg("%d bytes written to disk", len);
-                return;
-            }
-        }
-        close(fd);
+    return NULL;
+}
+
+void e_worker_start() {
+    pthread_mutex_init(&E.worker.lock, NULL);
+    pthread_cond_init(&E.worker.cond, NULL);
+    pthread_mutex_lock(&E.worker.lock);
+    if (pthread_create(&E.worker.thread, NULL, e_worker_main, NULL) != 0) {
+        pthread_mutex_unlock(&E.worker.lock);
+        return;
     }
-    free(buf);
-    e_set_status_msg("Can't save! I/O error: %s", strerror(errno));
+    E.worker.running = 1;
 }
 
-// find
-void e_find_cb(char *query, int key) {
-    static int last_match = -1;
-    static int direction = 1;
+void e_worker_acquire() {
+    if (E.worker.running) {
+        atomic_store(&E.worker.main_waiting, 0);
+        pthread_mutex_lock(&E.worker.lock);
+    }
+}
+
+void e_worker_release() {
+    if (E.worker.running) {
+        atomic_store(&E.worker.main_waiting, 1);
+        pthread_cond_signal(&E.worker.cond);
+        pthread_mutex_unlock(&E.worker.lock);
+    }
+}
+
+// called by the worker, with the lock held
+void e_worker_wake_main() {
+    E.woken = 1;
+    write(E.sig_pipe[1], "j", 1);
+}
+
+int e_worker_submit(struct e_find_job *job) {
+    if (!E.worker.running) {
+        return 0;
+    }
+    if (E.worker.search) {
+        e_find_job_free(E.worker.search);
+    }
+    E.worker.search = job;
+    return 1;
+}
+
+// buffers
+static void e_buffer_leave() {
+    if (E.worker.search) {
+        e_find_job_free(E.worker.search);
+        E.worker.search = NULL;
+    }
+    E.buf.find.pending = 0;
+    E.frame_full = 1;
+}
+
+void e_buffer_new() {
+    if (E.n_bufs) {
+        e_buffer_leave();
+        E.bufs[E.cur_buf] = E.buf;
+    }
+    E.bufs = realloc(E.bufs, sizeof(struct e_buffer) * (E.n_bufs + 1));
+    if (E.bufs == NULL) {
+        die("realloc");
+    }
+    memset(&E.buf, 0, sizeof(E.buf));
+    E.buf.cache.cap = PAGU_RENDER_CACHE;
+    E.buf.undo.limit = E.undo_limit;
+    E.cur_buf = E.n_bufs++;
+}
 
-    static int saved_hl_line;
-    static char *saved_hl = NULL;
-    if (saved_hl) {
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].r_size);
-        free(saved_hl);
-        saved_hl = NULL;
+void e_buffer_switch(int i) {
+    if (i == E.cur_buf || i < 0 || i >= E.n_bufs) {
+        return;
     }
+    e_buffer_leave();
+    E.bufs[E.cur_buf] = E.buf;
+    E.buf = E.bufs[i];
+    E.cur_buf = i;
+}
 
-    if (key == '\r' || key == '\x1b') {
-        last_match = -1;
-        direction = 1;
+void e_buffer_close() {
+    e_buffer_leave();
+    e_close();
+    E.n_bufs--;
+    memmove(&E.bufs[E.cur_buf], &E.bufs[E.cur_buf + 1],
+            sizeof(struct e_buffer) * (E.n_bufs - E.cur_buf));
+    if (E.n_bufs == 0) {
+        e_buffer_new();
         return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        last_match = -1;
-        direction = 1;
-    }
-
-    if (last_match == -1) {
-        direction = 1;
-    }
-    int current = last_match;
-    int i;
-    for (i = 0; i < E.n_rows; i++) {
-        current += direction;
-        if (current == -1) {
-            current = E.n_rows - 1;
-        } else if (current == E.n_rows) {
-            current = 0;
-        }
-        e_row *row = &E.row[current];
-        char *match = strstr(row->render, query);
-        if (match) {
-            last_match = current;
-            E.cy = current;
-            E.cx = e_rxcx(row, match - row->render);
-            E.row_off = E.n_rows;
-
-            saved_hl_line = current;
-            saved_hl = malloc(row->r_size);
-            memcpy(saved_hl, row->hl, row->r_size);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
-        }
     }
+    if (E.cur_buf > 0) {
+        E.cur_buf--;
+    }
+    E.buf = E.bufs[E.cur_buf];
 }
 
-void e_find() {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.col_off;
-    int saved_rowoff = E.row_off;
+// the same file under another path matches by device and inode
+int e_buffer_find(const char *filename) {
+    struct stat want, st;
+    int exists = stat(filename, &want) == 0;
+    for (int i = 0; i < E.n_bufs; i++) {
+        const char *name = i == E.cur_buf ? E.buf.filename : E.bufs[i].filename;
+        if (name == NULL) {
+            continue;
+        }
+        if (!strcmp(name, filename) ||
+            (exists && stat(name, &st) == 0 && st.st_dev == want.st_dev &&
+             st.st_ino == want.st_ino)) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    char *query = e_prompt("Search: %s (Use ESC/Arrows/Enter)", e_find_cb);
+int e_buffers_dirty() {
+    int n = 0;
+    for (int i = 0; i < E.n_bufs; i++) {
+        n += (i == E.cur_buf ? E.buf.dirty : E.bufs[i].dirty) != 0;
+    }
+    return n;
+}
 
-    if (query) {
-        free(query);
-    } else {
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.col_off = saved_coloff;
-        E.row_off = saved_rowoff;
+void e_buffer_open() {
+    char *filename = e_prompt("Open: %s (ESC to cancel)", NULL);
+    if (filename == NULL) {
+        return;
+    }
+    int i = e_buffer_find(filename);
+    if (i != -1) {
+        e_buffer_switch(i);
+        free(filename);
+        return;
+    }
+    int from = E.cur_buf;
+    int need_new = E.buf.filename || E.buf.n_rows || E.buf.dirty;
+    if (need_new) {
+        e_buffer_new();
     }
+    if (e_open(filename) == -1) {
+        e_set_status_msg("Can't open %s: %s", filename, strerror(errno));
+        if (need_new) {
+            e_buffer_close();
+            e_buffer_switch(from);
+        }
+    }
+    free(filename);
 }
 
 // append buffer
-void ab_append(struct abuf *ab, const char *s, int len) {
-    char *new = realloc(ab->b, ab->len + len);
-    if (new == NULL)
+void ab_reserve(struct abuf *ab, int len) {
+    if (ab->len + len <= ab->cap) {
         return;
-    memcpy(&new[ab->len], s, len);
+    }
+    int cap = ab->cap ? ab->cap : 256;
+    while (cap < ab->len + len) {
+        cap *= 2;
+    }
+    char *new = realloc(ab->b, cap);
+    if (new == NULL)
+        die("realloc");
     ab->b = new;
+    ab->cap = cap;
+    E.stats.allocs++;
+}
+
+void ab_append(struct abuf *ab, const char *s, int len) {
+    ab_reserve(ab, len);
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
 
-void ab_free(struct abuf *ab) { free(ab->b); }
+void ab_append_cells(struct abuf *ab, const struct e_cell *cells, int n) {
+    ab_reserve(ab, n);
+    char *p = &ab->b[ab->len];
+    for (int i = 0; i < n; i++) {
+        p[i] = cells[i].ch;
+    }
+    ab->len += n;
+}
+
+void ab_free(struct abuf *ab) {
+    free(ab->b);
+    ab->b = NULL;
+    ab->len = ab->cap = 0;
+}
 
 // input
+static int e_key_edits(int c) {
+    switch (c) {
+    case CTRL_KEY('q'):
+    case CTRL_KEY('f'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('o'):
+    case CTRL_KEY('n'):
+    case CTRL_KEY('p'):
+    case CTRL_KEY('w'):
+    case CTRL_KEY('l'):
+    case HOME_KEY:
+    case END_KEY:
+    case PAGE_UP:
+    case PAGE_DOWN:
+    case ARROW_UP:
+    case ARROW_DOWN:
+    case ARROW_LEFT:
+    case ARROW_RIGHT:
+    case '\x1b':
+    case JOB_KEY:
+        return 0;
+    }
+    return 1;
+}
+
 void e_process_keypress() {
     static int quit_times = PAGU_QUIT_TIMES;
+    static int quit_key = 0;
 
     int c = e_read_key();
+    // a warning only counts for the key that raised it
+    if (c != quit_key) {
+        quit_times = PAGU_QUIT_TIMES;
+    }
+    if (E.buf.readonly && e_key_edits(c)) {
+        e_set_status_msg("Buffer is read-only");
+        return;
+    }
+    e_undo_begin(c);
     switch (c) {
 
     case '\r':
@@ -823,12 +5603,16 @@ void e_process_keypress() {
         break;
 
     case CTRL_KEY('q'):
-        if (E.dirty && quit_times > 0) {
-            e_set_status_msg("WARNING! File has unsaved changes. "
-                             "Press Ctrl-Q again to quit or Ctrl-S to save.");
+        if (e_buffers_dirty() && quit_times > 0) {
+            e_set_status_msg("WARNING! %d file(s) have unsaved changes. "
+                             "Press Ctrl-Q again to quit or Ctrl-S to save.",
+                             e_buffers_dirty());
             quit_times--;
+            quit_key = c;
             return;
         }
+        e_sidecar_store_all();
+        e_journal_drop_all();
         write(STDOUT_FILENO, "\x1b[2J", 4);
         write(STDOUT_FILENO, "\x1b[H", 3);
         exit(0);
@@ -838,6 +5622,46 @@ void e_process_keypress() {
         e_find();
         break;
 
+    case CTRL_KEY('o'):
+        e_buffer_open();
+        break;
+
+    case CTRL_KEY('n'):
+    case CTRL_KEY('p'):
+        e_buffer_switch((E.cur_buf + (c == CTRL_KEY('n') ? 1 : E.n_bufs - 1)) %
+                        E.n_bufs);
+        break;
+
+    case CTRL_KEY('w'):
+        if (E.buf.dirty && quit_times > 0) {
+            e_set_status_msg("WARNING! File has unsaved changes. "
+                             "Press Ctrl-W again to close it or Ctrl-S to save.");
+            quit_times--;
+            quit_key = c;
+            return;
+        }
+        e_buffer_close();
+        break;
+
+    case CTRL_KEY('t'):
+        E.show_stats = (E.show_stats + 1) % 4;
+        if (E.show_stats == 3) {
+            E.prof.on = 1;
+        }
+        break;
+
+    case CTRL_KEY('z'):
+        e_undo();
+        break;
+
+    case CTRL_KEY('y'):
+        e_redo();
+        break;
+
+    case PASTE_KEY:
+        e_insert_text(E.paste.b, E.paste.len);
+        break;
+
     case BACKSPACE:
     case CTRL_KEY('h'):
         e_delete_char();
@@ -849,22 +5673,23 @@ void e_process_keypress() {
         break;
 
     case HOME_KEY:
-        E.cx = 0;
+        E.buf.cx = 0;
         break;
     case END_KEY:
-        if (E.cy < E.n_rows) {
-            E.cx = E.row[E.cy].size;
+        if (E.buf.cy < E.buf.n_rows) {
+            E.buf.cx = e_row_at(E.buf.cy)->size;
         }
         break;
 
     case PAGE_UP:
     case PAGE_DOWN: {
+        e_scroll(); // keys are batched, row_off may predate earlier ones
         if (c == PAGE_UP) {
-            E.cy = E.row_off;
+            E.buf.cy = E.buf.row_off;
         } else if (c == PAGE_DOWN) {
-            E.cy = E.row_off + E.screen_rows - 1;
-            if (E.cy > E.n_rows) {
-                E.cy = E.n_rows;
+            E.buf.cy = E.buf.row_off + E.screen_rows - 1;
+            if (E.buf.cy > E.buf.n_rows) {
+                E.buf.cy = E.buf.n_rows;
             }
         }
 
@@ -883,58 +5708,60 @@ void e_process_keypress() {
 
     case CTRL_KEY('l'):
     case '\x1b':
+    case JOB_KEY:
         break;
 
     default:
         e_insert_char(c);
         break;
     }
+    e_undo_end();
     quit_times = PAGU_QUIT_TIMES;
 }
 
 void e_move_cursor(int key) {
-    e_row *row = (E.cy >= E.n_rows) ? NULL : &E.row[E.cy];
+    e_row *row = e_row_at(E.buf.cy);
 
     switch (key) {
     case ARROW_LEFT:
-        if (E.cx != 0) {
-            E.cx--;
-        } else if (E.cy > 0) {
-            E.cy--;
-            E.cx = E.row[E.cy].size;
+        if (E.buf.cx != 0) {
+            E.buf.cx--;
+        } else if (E.buf.cy > 0) {
+            E.buf.cy--;
+            E.buf.cx = e_row_at(E.buf.cy)->size;
         }
         break;
     case ARROW_RIGHT:
-        if (row && E.render_x < row->r_size) {
-            E.cx++;
-            E.render_x = e_cxrx(row, E.cx);
-        } else if (row && E.render_x == row->r_size && E.cy < E.n_rows - 1) {
-            E.cy++;
-            E.cx = 0;
-            E.render_x = 0;
+        if (row && E.buf.cx < row->size) {
+            E.buf.cx++;
+            E.buf.render_x = e_cxrx(row, E.buf.cx);
+        } else if (row && E.buf.cx == row->size && E.buf.cy < E.buf.n_rows - 1) {
+            E.buf.cy++;
+            E.buf.cx = 0;
+            E.buf.render_x = 0;
         }
         break;
     case ARROW_UP:
-        if (E.cy > 0) {
-            E.cy--;
+        if (E.buf.cy > 0) {
+            E.buf.cy--;
         }
         break;
     case ARROW_DOWN:
-        if (E.cy < E.n_rows - 1) {
-            E.cy++;
+        if (E.buf.cy < E.buf.n_rows - 1) {
+            E.buf.cy++;
         }
         break;
     }
 
-    row = (E.cy < E.n_rows) ? &E.row[E.cy] : NULL;
+    row = e_row_at(E.buf.cy);
     int rowlen = row ? row->size : 0;
-    if (E.cx > rowlen)
-        E.cx = rowlen;
+    if (E.buf.cx > rowlen)
+        E.buf.cx = rowlen;
 
     if (row) {
-        E.render_x = e_cxrx(row, E.cx);
+        E.buf.render_x = e_cxrx(row, E.buf.cx);
     } else {
-        E.render_x = 0;
+        E.buf.render_x = 0;
     }
 }
 
@@ -967,6 +5794,16 @@ char *e_prompt(char *prompt, void (*callback)(char *, int)) {
                 }
                 return buf;
             }
+        } else if (c == PASTE_KEY) {
+            for (int i = 0; i < E.paste.len; i++) {
+                if (iscntrl((unsigned char)E.paste.b[i])) continue;
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = E.paste.b[i];
+                buf[buflen] = '\0';
+            }
         } else if (!iscntrl(c) && c < 128) {
             if (buflen == bufsize - 1) {
                 bufsize *= 2;
@@ -983,149 +5820,368 @@ char *e_prompt(char *prompt, void (*callback)(char *, int)) {
 
 // output
 void e_clear() {
+    long allocs = E.stats.allocs;
+    long long t = e_prof_begin();
     e_scroll();
-    struct abuf ab = ABUF_INIT;
-    ab_append(&ab, "\x1b[?25l", 6);
-    ab_append(&ab, "\x1b[H", 3);
-    e_draw_rows(&ab);
-    e_draw_bar(&ab);
-    e_draw_msg(&ab);
+    e_draw_rows();
+    e_draw_bar();
+    e_draw_msg();
+    e_flush_frame();
+    e_prof_end(PROF_RENDER, t);
+    E.stats.frame_allocs = E.stats.allocs - allocs;
+}
+
+void e_frame_resize() {
+    int cells = (E.screen_rows + 2) * E.screen_cols;
+    E.frame = realloc(E.frame, sizeof(struct e_cell) * cells);
+    E.prev_frame = realloc(E.prev_frame, sizeof(struct e_cell) * cells);
+    E.line_row = realloc(E.line_row, sizeof(e_row *) * E.screen_rows);
+    E.line_num = realloc(E.line_num, sizeof(int) * E.screen_rows);
+    E.frame_full = 1;
+    E.stats.allocs += 4;
+    E.ob.len = 0;
+    ab_reserve(&E.ob, cells * 12 + 256);
+}
+
+static void e_frame_clear_line(int y) {
+    struct e_cell *cell = &E.frame[y * E.screen_cols];
+    for (int x = 0; x < E.screen_cols; x++) {
+        cell[x].ch = ' ';
+        cell[x].attr = 0;
+    }
+}
+
+static int e_frame_puts(int y, int x, const char *s, int len,
+                        unsigned char attr) {
+    struct e_cell *cell = &E.frame[y * E.screen_cols];
+    for (int j = 0; j < len && x < E.screen_cols; j++, x++) {
+        cell[x].ch = s[j];
+        cell[x].attr = attr;
+    }
+    return x;
+}
+
+static void ab_append_attr(struct abuf *ab, int attr) {
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "\x1b[0%s", attr & ATTR_INVERSE ? ";7" : "");
+    if (attr & ATTR_COLOR) {
+        len += snprintf(buf + len, sizeof(buf) - len, ";%d", attr & ATTR_COLOR);
+    }
+    buf[len++] = 'm';
+    ab_append(ab, buf, len);
+}
+
+void e_flush_frame() {
+    struct abuf *ab = &E.ob;
+    int cols = E.screen_cols;
+    int attr = -1;
     char buf[32];
-    E.cx_off = snprintf(NULL, 0, "%d ", E.n_rows) + 1;
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.row_off) + 1,
-             (E.render_x - E.col_off) + 1 + E.cx_off);
-    ab_append(&ab, buf, strlen(buf));
-    ab_append(&ab, "\x1b[?25h", 6);
-    write(STDOUT_FILENO, ab.b, ab.len);
-    ab_free(&ab);
+
+    ab_append(ab, "\x1b[?25l", 6);
+    if (E.frame_full) {
+        ab_append(ab, "\x1b[m\x1b[2J", 7);
+        attr = 0;
+        for (int i = 0; i < (E.screen_rows + 2) * cols; i++) {
+            E.prev_frame[i].ch = ' ';
+            E.prev_frame[i].attr = 0;
+        }
+    }
+    int lines = 0;
+    for (int y = 0; y < E.screen_rows + 2; y++) {
+        struct e_cell *cur = &E.frame[y * cols];
+        struct e_cell *old = &E.prev_frame[y * cols];
+        int x0 = 0;
+        int x1 = cols - 1;
+        while (x0 < cols && cur[x0].ch == old[x0].ch && cur[x0].attr == old[x0].attr) x0++;
+        if (x0 == cols) {
+            continue;
+        }
+        while (cur[x1].ch == old[x1].ch && cur[x1].attr == old[x1].attr) x1--;
+        lines++;
+
+        int last = cols - 1;
+        while (last >= x0 && cur[last].ch == ' ' && cur[last].attr == 0) last--;
+        int erase = last < x1;
+        if (erase) x1 = last;
+
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x0 + 1);
+        ab_append(ab, buf, len);
+        for (int x = x0; x <= x1;) {
+            if (cur[x].attr != attr) {
+                attr = cur[x].attr;
+                ab_append_attr(ab, attr);
+            }
+            int run = x + 1;
+            while (run <= x1 && cur[run].attr == attr) run++;
+            ab_append_cells(ab, &cur[x], run - x);
+            x = run;
+        }
+        if (erase) {
+            if (attr != 0) {
+                ab_append(ab, "\x1b[m", 3);
+                attr = 0;
+            }
+            ab_append(ab, "\x1b[K", 3);
+        }
+    }
+    if (attr > 0) {
+        ab_append(ab, "\x1b[m", 3);
+    }
+
+    int cy = (E.buf.cy - E.buf.row_off) + 1;
+    int cx = (E.buf.render_x - E.buf.col_off) + 1 + E.cx_off;
+    if (lines || E.frame_full || cy != E.frame_cy || cx != E.frame_cx) {
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy, cx);
+        ab_append(ab, buf, len);
+        ab_append(ab, "\x1b[?25h", 6);
+        long long t = e_prof_begin();
+        for (int off = 0; off < ab->len;) {
+            ssize_t n = write(E.out, ab->b + off, ab->len - off);
+            if (n == -1) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                break;
+            }
+            off += n;
+        }
+        e_prof_end(PROF_WRITE, t);
+        E.frame_cy = cy;
+        E.frame_cx = cx;
+        E.stats.frame_bytes = ab->len;
+    } else {
+        E.stats.frame_bytes = 0;
+    }
+    E.stats.frames++;
+    E.stats.bytes += E.stats.frame_bytes;
+    E.stats.frame_lines = lines;
+    ab->len = 0;
+
+    struct e_cell *t = E.prev_frame;
+    E.prev_frame = E.frame;
+    E.frame = t;
+    memcpy(E.frame, E.prev_frame, sizeof(struct e_cell) * (E.screen_rows + 2) * cols);
+    E.frame_full = 0;
 }
 
-void e_draw_rows(struct abuf *ab) {
-    ab_append(ab, "\x1b[K", 3); // k -> erase line
-    char line_number[16];
-    int line_number_width = snprintf(NULL, 0, "%d", E.n_rows) + 1;
+void e_draw_rows() {
+    int line_number_width = snprintf(NULL, 0, "%d", E.buf.n_rows) + 1;
+    int rebuild = E.frame_full || E.buf.col_off != E.frame_col_off ||
+                  line_number_width != E.frame_lnw;
+    E.frame_col_off = E.buf.col_off;
+    E.frame_lnw = line_number_width;
+    int sync_to = E.buf.row_off + E.screen_rows;
+    if (sync_to - E.buf.hl_frontier <= PAGU_SYNC_ROWS) {
+        e_syntax_sync(sync_to);
+    } else if (!E.worker.running) {
+        e_syntax_sync(E.buf.hl_frontier + PAGU_SYNC_ROWS);
+    }
 
+    e_row *row = e_row_at(E.buf.row_off);
     for (int y = 0; y < E.screen_rows; y++) {
-        int filerow = y + E.row_off;
-        if (filerow >= E.n_rows) {
-            if (E.n_rows == 0 && y == E.screen_rows / 3) {
+        int filerow = y + E.buf.row_off;
+        if (row == NULL) {
+            E.line_row[y] = NULL;
+            e_frame_clear_line(y);
+            if (E.buf.n_rows == 0 && y == E.screen_rows / 3) {
                 char welcome[80];
                 int welcomelen =
                     snprintf(welcome, sizeof(welcome),
-                             "pagu editor -- version %s\r\n", PAGU_V);
+                             "pagu editor -- version %s", PAGU_V);
                 if (welcomelen > E.screen_cols) {
                     welcomelen = E.screen_cols;
                 }
                 int padding = (E.screen_cols - welcomelen) / 2;
-                if (padding) {
-                    ab_append(ab, "~", 1);
-                    padding--;
+                e_frame_puts(y, 0, padding ? "~" : "", padding ? 1 : 0, 0);
+                e_frame_puts(y, padding, welcome, welcomelen, 0);
+            } else {
+                e_frame_puts(y, 0, "~", 1, 0);
+            }
+            continue;
+        }
+
+        e_row_render(row);
+        row->flags |= ROW_REF;
+        if (!rebuild && E.line_row[y] == row && E.line_num[y] == filerow &&
+            !(row->flags & ROW_DAMAGED)) {
+            row = e_row_next(row);
+            continue;
+        }
+        E.line_row[y] = row;
+        E.line_num[y] = filerow;
+        row->flags &= ~ROW_DAMAGED;
+        e_frame_clear_line(y);
+
+        char line_number[16];
+        int x = snprintf(line_number, sizeof(line_number), "%*d ",
+                         line_number_width, filerow + 1);
+        e_frame_puts(y, 0, line_number, x, 0);
+
+        int j = E.buf.col_off < row->size ? E.buf.col_off : row->size;
+        int rx = j;
+        if (!(row->flags & ROW_NOTABS)) {
+            j = rx = 0;
+            const char *p;
+            int len;
+            for (int span = 0; (len = e_row_span(row, span, &p)) > 0; span++) {
+                int i = 0;
+                for (; i < len; i++) {
+                    int w = p[i] == '\t' ? PAGU_TAB_STOP - rx % PAGU_TAB_STOP : 1;
+                    if (rx + w > E.buf.col_off) {
+                        break;
+                    }
+                    rx += w;
                 }
-                while (padding--) {
-                    ab_append(ab, " ", 1);
+                j += i;
+                if (i < len) {
+                    break;
                 }
-                ab_append(ab, welcome, welcomelen);
-            } else {
-                ab_append(ab, "~\r\n", 3);
             }
+        }
+        const char *c;
+        unsigned char *hl;
+        int n = row->size - j;
+        if (row->flags & ROW_CHUNKED) {
+            static char *slice;
+            static int slice_cap;
+            n = n < E.screen_cols ? n : E.screen_cols;
+            if (n > slice_cap) {
+                slice_cap = n;
+                slice = realloc(slice, slice_cap);
+            }
+            e_row_window(row, j, n);
+            e_row_copy(row, j, n, slice);
+            c = slice;
+            hl = &row->hl[j - row->segs->hl_at];
         } else {
-            snprintf(line_number, sizeof(line_number), "%*d ",
-                     line_number_width, filerow + 1);
-            ab_append(ab, line_number, strlen(line_number));
-
-            int len = E.row[filerow].r_size - E.col_off;
-            if (len < 0) {
-                len = 0;
-            }
-            if (len > E.screen_cols) {
-                len = E.screen_cols;
-            }
-            char *c = &E.row[filerow].render[E.col_off];
-            unsigned char *hl = &E.row[filerow].hl[E.col_off];
-            int current_color = -1;
-            int j;
-            for (j = 0; j < len; j++) {
-                if (iscntrl(c[j])) {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    ab_append(ab, "\x1b[7m", 4);
-                    ab_append(ab, &sym, 1);
-                    ab_append(ab, "\x1b[m", 3);
-                    if (current_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        ab_append(ab, buf, clen);
-                    }
-                } else if (hl[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        ab_append(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    ab_append(ab, &c[j], 1);
-                } else {
-                    int color = e_syntax_to_color(hl[j]);
-                    if (color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen =
-                            snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        ab_append(ab, buf, clen);
-                    }
-                    ab_append(ab, &c[j], 1);
+            c = &row->chars[j];
+            hl = &row->hl[j];
+        }
+        struct e_cell *cell = &E.frame[y * E.screen_cols];
+        for (j = 0; j < n && x < E.screen_cols; j++) {
+            unsigned char attr = hl[j] == HL_NORMAL ? 0 : e_syntax_to_color(hl[j]);
+            if (c[j] == '\t') {
+                int w = PAGU_TAB_STOP - rx % PAGU_TAB_STOP;
+                for (int k = rx < E.buf.col_off ? E.buf.col_off - rx : 0;
+                     k < w && x < E.screen_cols; k++, x++) {
+                    cell[x].ch = ' ';
+                    cell[x].attr = attr;
                 }
+                rx += w;
+                continue;
+            }
+            if (iscntrl(c[j])) {
+                cell[x].ch = (c[j] <= 26) ? '@' + c[j] : '?';
+                cell[x].attr = ATTR_INVERSE;
+            } else {
+                cell[x].ch = c[j];
+                cell[x].attr = attr;
             }
-            ab_append(ab, "\x1b[39m", 5);
-            ab_append(ab, "\r\n", 2);
+            rx++;
+            x++;
         }
-        ab_append(ab, "\x1b[K", 3);
+        row = e_row_next(row);
     }
 }
 
 void e_scroll() {
-    E.render_x = E.cx_off;
-    if (E.cy < E.n_rows) {
-        E.render_x = e_cxrx(&E.row[E.cy], E.cx);
+    E.cx_off = snprintf(NULL, 0, "%d ", E.buf.n_rows) + 1;
+    E.buf.render_x = 0;
+    if (E.buf.cy < E.buf.n_rows) {
+        E.buf.render_x = e_cxrx(e_row_at(E.buf.cy), E.buf.cx);
     }
 
-    // E.render_x = E.cx;
-    if (E.cy < E.row_off) {
-        E.row_off = E.cy;
+    int text_cols = E.screen_cols - E.cx_off;
+    if (E.buf.cy < E.buf.row_off) {
+        E.buf.row_off = E.buf.cy;
     }
-    if (E.cy >= E.row_off + E.screen_rows - 2) {
-        E.row_off = E.cy - E.screen_rows + 3;
+    if (E.buf.cy >= E.buf.row_off + E.screen_rows - 2) {
+        E.buf.row_off = E.buf.cy - E.screen_rows + 3;
     }
-    if (E.render_x < E.col_off) {
-        E.col_off = E.render_x;
+    if (E.buf.render_x < E.buf.col_off) {
+        E.buf.col_off = E.buf.render_x;
     }
-    if (E.render_x >= E.col_off + E.screen_cols) {
-        E.col_off = E.render_x - E.screen_cols + 1;
+    if (E.buf.render_x >= E.buf.col_off + text_cols) {
+        E.buf.col_off = E.buf.render_x - text_cols + 1;
     }
 }
 
-void e_draw_bar(struct abuf *ab) {
-    ab_append(ab, "\x1b[7m", 4);
+void e_draw_bar() {
+    int y = E.screen_rows;
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       E.filename ? E.filename : "[No Name]", E.n_rows,
-                       E.dirty ? "(modified)" : "");
-    int rlen =
-        snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-                 E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.n_rows);
+    int len, rlen;
+    if (E.show_stats == 3) {
+        struct e_hist *lat = &E.prof.hist[PROF_LATENCY];
+        len = snprintf(status, sizeof(status),
+                       "latency p50 %.2f p99 %.2f max %.2f ms, %ld keys",
+                       e_hist_pct(lat, 50) / 1e6, e_hist_pct(lat, 99) / 1e6,
+                       lat->max / 1e6, lat->count);
+        double frames = E.prof.hist[PROF_RENDER].count ? E.prof.hist[PROF_RENDER].count : 1;
+        rlen = snprintf(rstatus, sizeof(rstatus),
+                        "us/frame: in %.0f edit %.0f hl %.0f draw %.0f write %.0f",
+                        E.prof.hist[PROF_INPUT].total / frames / 1e3,
+                        E.prof.hist[PROF_EDIT].total / frames / 1e3,
+                        E.prof.hist[PROF_HL].total / frames / 1e3,
+                        E.prof.hist[PROF_RENDER].total / frames / 1e3,
+                        E.prof.hist[PROF_WRITE].total / frames / 1e3);
+    } else if (E.show_stats == 2) {
+        len = snprintf(status, sizeof(status),
+                       "rows: %.1f MB live, %.1f MB slack, %.0f%% free in %d slabs",
+                       E.buf.mem.live / 1e6, (E.buf.mem.used - E.buf.mem.live) / 1e6,
+                       E.buf.mem.slab ? 100.0 * (E.buf.mem.slab - (E.buf.mem.used - E.buf.mem.large)) / E.buf.mem.slab : 0.0,
+                       E.buf.mem.nslabs);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%.1f MB large, %d hl",
+                        E.buf.mem.large / 1e6, E.buf.cache.n);
+    } else if (E.show_stats) {
+        len = snprintf(status, sizeof(status),
+                       "frame %ld: %d bytes, %d lines, %d allocs (%ld total)",
+                       E.stats.frames, E.stats.frame_bytes, E.stats.frame_lines,
+                       E.stats.frame_allocs, E.stats.allocs);
+        rlen = snprintf(rstatus, sizeof(rstatus), "avg %.0f bytes/frame",
+                        E.stats.frames ? (double)E.stats.bytes / E.stats.frames : 0.0);
+    } else {
+        char nbuf[32] = "";
+        if (E.n_bufs > 1) {
+            snprintf(nbuf, sizeof(nbuf), "[%d/%d] ", E.cur_buf + 1, E.n_bufs);
+        }
+        const char *name = E.buf.filename        ? E.buf.filename
+                           : E.buf.stream.follow ? "[stdin]"
+                                                 : "[No Name]";
+        const char *state = E.buf.dirty                ? "(modified)"
+                            : !E.buf.stream.follow     ? ""
+                            : E.buf.stream.fd == -1    ? "(ended)"
+                            : E.buf.cy >= E.buf.n_rows - 1 ? "(following)"
+                                                           : "(streaming)";
+        len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s", nbuf,
+                       name, E.buf.n_rows, state);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+                        E.buf.syntax ? E.buf.syntax->filetype : "no ft", E.buf.cy + 1,
+                        E.buf.n_rows);
+    }
+    if (E.buf.find.active && (E.buf.find.qlen || E.buf.find.regex)) {
+        const char *mode = E.buf.find.regex ? "regex: " : "";
+        if (E.buf.find.error) {
+            rlen = snprintf(rstatus, sizeof(rstatus), "%s%s", mode, E.buf.find.error);
+        } else if (E.buf.find.pending) {
+            rlen = snprintf(rstatus, sizeof(rstatus), "%ssearching...", mode);
+        } else if (E.buf.find.n) {
+            rlen = snprintf(rstatus, sizeof(rstatus), "%s%d of %d matches", mode,
+                            E.buf.find.cur + 1, E.buf.find.n);
+        } else {
+            rlen = snprintf(rstatus, sizeof(rstatus), "%sno matches", mode);
+        }
+    }
 
+    struct e_cell *cell = &E.frame[y * E.screen_cols];
+    for (int x = 0; x < E.screen_cols; x++) {
+        cell[x].ch = ' ';
+        cell[x].attr = ATTR_INVERSE;
+    }
     if (len > E.screen_cols) {
         len = E.screen_cols;
     }
-    ab_append(ab, status, len);
-    while (len < E.screen_cols) {
-        if (E.screen_cols - len == rlen) {
-            ab_append(ab, rstatus, rlen);
-            break;
-        } else {
-            ab_append(ab, " ", 1);
-            len++;
-        }
+    e_frame_puts(y, 0, status, len, ATTR_INVERSE);
+    if (E.screen_cols - len >= rlen) {
+        e_frame_puts(y, E.screen_cols - rlen, rstatus, rlen, ATTR_INVERSE);
     }
-    ab_append(ab, "\x1b[m", 3);
-    ab_append(ab, "\r\n", 2);
 }
 
 void e_set_status_msg(const char *fmt, ...) {
@@ -1136,35 +6192,450 @@ void e_set_status_msg(const char *fmt, ...) {
     E.statusmsg_time = time(NULL);
 }
 
-void e_draw_msg(struct abuf *ab) {
-    ab_append(ab, "\x1b[K", 3);
+void e_draw_msg() {
+    int y = E.screen_rows + 1;
+    e_frame_clear_line(y);
     int msglen = strlen(E.statusmsg);
     if (msglen > E.screen_cols) {
         msglen = E.screen_cols;
     }
     if (msglen && time(NULL) - E.statusmsg_time < 5) {
-        ab_append(ab, E.statusmsg, msglen);
+        e_frame_puts(y, 0, E.statusmsg, msglen, 0);
+    }
+}
+
+// profile
+static long long e_prof_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int e_hist_bucket(long long ns) {
+    if (ns < 4) {
+        return ns < 0 ? 0 : ns;
+    }
+    int b = 63 - __builtin_clzll(ns);
+    return 4 * (b - 1) + ((ns >> (b - 2)) & 3);
+}
+
+static long long e_hist_top(int i) {
+    if (i < 4) {
+        return i;
+    }
+    return ((long long)(4 + i % 4 + 1) << (i / 4 - 1)) - 1;
+}
+
+static void e_hist_add(struct e_hist *h, long long ns) {
+    h->n[e_hist_bucket(ns)]++;
+    h->count++;
+    h->total += ns;
+    if (ns > h->max) {
+        h->max = ns;
+    }
+}
+
+long long e_hist_pct(struct e_hist *h, int pct) {
+    long need = (h->count * pct + 99) / 100;
+    long seen = 0;
+    for (int i = 0; i < 256; i++) {
+        seen += h->n[i];
+        if (seen >= need && seen) {
+            return e_hist_top(i) < h->max ? e_hist_top(i) : h->max;
+        }
+    }
+    return 0;
+}
+
+static void e_prof_record(int phase, long long at, long long dur, long long self) {
+    e_hist_add(&E.prof.hist[phase], self);
+    if (E.prof.events) {
+        struct e_prof_event *ev = &E.prof.events[E.prof.n_events++ % PAGU_PROF_EVENTS];
+        ev->at = at - E.prof.start;
+        ev->dur = dur;
+        ev->phase = phase;
+    }
+}
+
+void e_prof_init() {
+    static int registered;
+    char *trace = getenv("PAGU_TRACE");
+    char *profile = getenv("PAGU_PROFILE");
+    if (profile && *profile && *profile != '0') {
+        E.prof.on = 1;
+    }
+    if (trace && *trace && !registered) {
+        E.prof.on = 1;
+        E.prof.trace = trace;
+        E.prof.events = malloc(sizeof(struct e_prof_event) * PAGU_PROF_EVENTS);
+        atexit(e_prof_dump);
+        registered = 1;
+    }
+    if (E.prof.start == 0) {
+        E.prof.start = e_prof_now();
+    }
+}
+
+long long e_prof_begin() {
+    if (!E.prof.on) {
+        return 0;
+    }
+    if (E.prof.depth < PAGU_PROF_DEPTH) {
+        E.prof.child[E.prof.depth] = 0;
+    }
+    E.prof.depth++;
+    return e_prof_now();
+}
+
+void e_prof_end(int phase, long long t) {
+    if (t == 0) {
+        return;
+    }
+    long long dur = e_prof_now() - t;
+    int d = --E.prof.depth;
+    long long nested = d < PAGU_PROF_DEPTH ? E.prof.child[d] : 0;
+    if (d > 0 && d - 1 < PAGU_PROF_DEPTH) {
+        E.prof.child[d - 1] += dur;
+    }
+    e_prof_record(phase, t, dur, dur - nested);
+}
+
+void e_prof_key() {
+    if (E.prof.on && E.prof.key_at == 0 && e_input_pending()) {
+        E.prof.key_at = e_prof_now();
+    }
+}
+
+void e_prof_frame() {
+    if (E.prof.key_at) {
+        long long dur = e_prof_now() - E.prof.key_at;
+        e_prof_record(PROF_LATENCY, E.prof.key_at, dur, dur);
+        E.prof.key_at = 0;
+    }
+}
+
+// the newest events as a Chrome trace
+void e_prof_dump() {
+    static const char *names[PROF_PHASES] = {"wait", "input", "edit", "highlight",
+                                             "render", "write", "latency"};
+    FILE *fp = fopen(E.prof.trace, "w");
+    if (fp == NULL) {
+        return;
+    }
+    fputs("{\"traceEvents\":[\n", fp);
+    unsigned int n = E.prof.n_events < PAGU_PROF_EVENTS ? E.prof.n_events : PAGU_PROF_EVENTS;
+    for (unsigned int i = E.prof.n_events - n; i != E.prof.n_events; i++) {
+        struct e_prof_event *ev = &E.prof.events[i % PAGU_PROF_EVENTS];
+        fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":1,\"tid\":%d}%s\n",
+                names[ev->phase], ev->at / 1e3, ev->dur / 1e3,
+                ev->phase == PROF_LATENCY ? 2 : 1, i + 1 != E.prof.n_events ? "," : "");
     }
+    fputs("],\"displayTimeUnit\":\"ms\",\"otherData\":{", fp);
+    for (int p = 0; p < PROF_PHASES; p++) {
+        struct e_hist *h = &E.prof.hist[p];
+        fprintf(fp, "%s\"%s\":\"%ld, p50 %.1f us, p99 %.1f us, max %.1f us, total %.3f ms\"",
+                p ? "," : "", names[p], h->count, e_hist_pct(h, 50) / 1e3,
+                e_hist_pct(h, 99) / 1e3, h->max / 1e3, h->total / 1e6);
+    }
+    fputs("}}\n", fp);
+    fclose(fp);
 }
 
 // init
 void e_init() {
-    E.cx = 0;
-    E.cy = 0;
+    E.tty = STDIN_FILENO;
+    E.out = STDOUT_FILENO;
+    E.bufs = NULL;
+    E.n_bufs = E.cur_buf = 0;
     E.cx_off = 0;
-    E.render_x = 0;
-    E.n_rows = 0;
-    E.dirty = 0;
-    E.row = NULL;
-    E.row_off = 0;
-    E.col_off = 0;
-    E.filename = NULL;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    E.syntax = NULL;
+    E.frame = NULL;
+    E.prev_frame = NULL;
+    E.line_row = NULL;
+    E.line_num = NULL;
+    E.ob = (struct abuf)ABUF_INIT;
+    E.paste = (struct abuf)ABUF_INIT;
+    E.show_stats = 0;
+    E.fsync_policy = PAGU_FSYNC;
+    char *fsync_policy = getenv("PAGU_FSYNC");
+    if (fsync_policy && *fsync_policy) {
+        E.fsync_policy = atoi(fsync_policy);
+    }
+    E.undo_limit = PAGU_UNDO_LIMIT;
+    char *limit = getenv("PAGU_UNDO_LIMIT");
+    if (limit && *limit) {
+        E.undo_limit = strtoull(limit, NULL, 10);
+    }
+    E.stream_lines = PAGU_STREAM_LINES;
+    char *lines = getenv("PAGU_STREAM_LINES");
+    if (lines && *lines) {
+        E.stream_lines = atoi(lines);
+    }
+    E.sidecar_min = PAGU_SIDECAR_MIN;
+    char *sidecar = getenv("PAGU_SIDECAR_MIN");
+    if (sidecar && *sidecar) {
+        E.sidecar_min = strtoll(sidecar, NULL, 10);
+    }
+    E.journal_ms = PAGU_JOURNAL_MS;
+    char *journal = getenv("PAGU_JOURNAL_MS");
+    if (journal && *journal) {
+        E.journal_ms = atoi(journal);
+    }
+    e_prof_init();
+    e_syntax_load();
+    e_buffer_new();
+}
 
+void e_term_init() {
+    if (!isatty(STDIN_FILENO) && (E.tty = open("/dev/tty", O_RDWR | O_CLOEXEC)) == -1) {
+        die("/dev/tty");
+    }
     if (get_window_size(&E.screen_rows, &E.screen_cols) == -1) {
         die("get_window_size");
     }
     E.screen_rows -= 2;
+    e_frame_resize();
+}
+
+// bench
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// reads a whole file, or synthesizes about `fallback` bytes of C
+static char *bench_load(char *path, size_t fallback, size_t *len) {
+    if (path) {
+        FILE *fp = fopen(path, "r");
+        if (!fp) {
+            perror(path);
+            return NULL;
+        }
+        fseek(fp, 0, SEEK_END);
+        *len = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        char *buf = malloc(*len + 1);
+        *len = fread(buf, 1, *len, fp);
+        buf[*len] = '\0';
+        fclose(fp);
+        return buf;
+    }
+    static const char *snippet =
+        "static int parse_line(struct state *st, const char *s, int len) {\n"
+        "    /* walk the line once */\n"
+        "    for (int i = 0; i < len; i++) {\n"
+        "        if (s[i] == '\\\\t' || st->flags & 0x10) continue;\n"
+        "        unsigned long v = strtoul(&s[i], NULL, 10); // value\n"
+        "        while (v > 42) { v /= 2; break; }\n"
+        "        return (double)v * 1.5f + sizeof(long);\n"
+        "    }\n"
+        "    return NULL;\n"
+        "}\n\n";
+    size_t slen = strlen(snippet);
+    char *buf = malloc(fallback + slen + 1);
+    *len = 0;
+    while (*len < fallback) {
+        memcpy(buf + *len, snippet, slen);
+        *len += slen;
+    }
+    return buf;
+}
+
+
+// headless replay: a script of keystrokes runs against a file on a
+// virtual terminal, each batch of keys is processed as the main loop
+// would and followed by one frame, written to /dev/null
+struct bench_op {
+    int batches;
+    double edit, edit_max;
+    double frame, frame_max;
+    long bytes;
+};
+
+static void bench_batch(struct bench_op *op, const char *keys, size_t len) {
+    E.feed.keys = keys;
+    E.feed.len = len;
+    double t0 = bench_now();
+    while (e_input_pending() || E.feed.len) {
+        if (!e_input_pending()) {
+            e_input_wait(0);
+        }
+        e_prof_key();
+        long long t = e_prof_begin();
+        e_process_keypress();
+        e_prof_end(PROF_EDIT, t);
+    }
+    double t1 = bench_now();
+    e_clear();
+    e_prof_frame();
+    double t2 = bench_now();
+    op->batches++;
+    op->edit += t1 - t0;
+    op->frame += t2 - t1;
+    op->edit_max = t1 - t0 > op->edit_max ? t1 - t0 : op->edit_max;
+    op->frame_max = t2 - t1 > op->frame_max ? t2 - t1 : op->frame_max;
+    op->bytes += E.stats.frame_bytes;
+}
+
+static const struct {
+    const char *name;
+    const char *keys;
+} bench_keys[] = {
+    {"up", "\x1b[A"},     {"down", "\x1b[B"},   {"right", "\x1b[C"},
+    {"left", "\x1b[D"},   {"pgup", "\x1b[5~"},  {"pgdn", "\x1b[6~"},
+    {"home", "\x1b[H"},   {"end", "\x1b[F"},    {"enter", "\r"},
+    {"backspace", "\x7f"}, {"del", "\x1b[3~"},   {"undo", "\x1a"},
+    {"redo", "\x19"},     {"save", "\x13"},
+};
+
+// one line of a script:
+//   size ROWS COLS     goto ROW [COL]     type TEXT (\n \t \\ escapes)
+//   key NAME [COUNT]   find QUERY         paste FILE | paste-lines COUNT
+// every typed character and every key is a batch of its own; a find or
+// a paste is one batch
+static int bench_replay_line(char *line, const char *label) {
+    char *arg = line + strcspn(line, " ");
+    if (*arg) {
+        *arg++ = '\0';
+    }
+    struct bench_op op = {0};
+    struct abuf keys = ABUF_INIT;
+    if (!strcmp(line, "size")) {
+        int rows, cols;
+        if (sscanf(arg, "%d %d", &rows, &cols) != 2 || rows < 3 || cols < 1) {
+            return -1;
+        }
+        E.screen_rows = rows - 2;
+        E.screen_cols = cols;
+        e_frame_resize();
+        return 0;
+    } else if (!strcmp(line, "goto")) {
+        int row = 1, col = 1;
+        sscanf(arg, "%d %d", &row, &col);
+        E.buf.cy = row < 1 ? 0 : row - 1 < E.buf.n_rows ? row - 1 : E.buf.n_rows;
+        int size = E.buf.cy < E.buf.n_rows ? e_row_at(E.buf.cy)->size : 0;
+        E.buf.cx = col < 1 ? 0 : col - 1 < size ? col - 1 : size;
+        bench_batch(&op, "", 0);
+    } else if (!strcmp(line, "type")) {
+        for (char *p = arg; *p; p++) {
+            char c = *p;
+            if (c == '\\' && p[1]) {
+                c = *++p == 'n' ? '\r' : *p == 't' ? '\t' : *p;
+            }
+            bench_batch(&op, &c, 1);
+        }
+    } else if (!strcmp(line, "key")) {
+        char name[16];
+        int count = 1;
+        if (sscanf(arg, "%15s %d", name, &count) < 1) {
+            return -1;
+        }
+        size_t k = 0;
+        while (k < sizeof(bench_keys) / sizeof(bench_keys[0]) &&
+               strcmp(bench_keys[k].name, name)) {
+            k++;
+        }
+        if (k == sizeof(bench_keys) / sizeof(bench_keys[0])) {
+            return -1;
+        }
+        while (count-- > 0) {
+            bench_batch(&op, bench_keys[k].keys, strlen(bench_keys[k].keys));
+        }
+    } else if (!strcmp(line, "find")) {
+        ab_append(&keys, "\x06", 1);
+        ab_append(&keys, arg, strlen(arg));
+        ab_append(&keys, "\r", 1);
+        bench_batch(&op, keys.b, keys.len);
+    } else if (!strcmp(line, "paste") || !strcmp(line, "paste-lines")) {
+        ab_append(&keys, "\x1b[200~", 6);
+        if (line[5] == '-') {
+            char text[64];
+            for (int i = 0, n = atoi(arg); i < n; i++) {
+                ab_append(&keys, text, snprintf(text, sizeof(text),
+                                                "    int pasted_%d = %d; // line\n", i, i));
+            }
+        } else {
+            size_t len;
+            char *text = bench_load(arg, 0, &len);
+            if (text == NULL) {
+                ab_free(&keys);
+                return -1;
+            }
+            ab_append(&keys, text, len);
+            free(text);
+        }
+        ab_append(&keys, "\x1b[201~", 6);
+        bench_batch(&op, keys.b, keys.len);
+    } else {
+        return -1;
+    }
+    ab_free(&keys);
+    printf("  %-24.24s %7d  %10.3f %9.1f  %10.3f %9.1f %9.1f %11ld\n", label,
+           op.batches, op.edit * 1e3, op.edit_max * 1e6, op.frame * 1e3,
+           op.frame / op.batches * 1e6, op.frame_max * 1e6, op.bytes);
+    return 0;
+}
+
+static int bench_replay_script(char *script, const char *name, char *path) {
+    e_init();
+    E.sidecar_min = 0; // every run starts cold
+    E.journal_ms = 0;
+    E.tty = -1;
+    E.out = open("/dev/null", O_WRONLY);
+    E.screen_rows = 48 - 2;
+    E.screen_cols = 160;
+    e_frame_resize();
+    double t0 = bench_now();
+    if (path && e_open(path) == -1) {
+        perror(path);
+        return 1;
+    }
+    printf("replay %s: %s, %d rows, opened in %.3f ms\n", name,
+           path ? path : "[No Name]", E.buf.n_rows, (bench_now() - t0) * 1e3);
+    printf("  %-24s %7s  %10s %9s  %10s %9s %9s %11s\n", "op", "batches",
+           "edit ms", "max us", "frames ms", "avg us", "max us", "bytes");
+    memset(&E.stats, 0, sizeof(E.stats));
+    E.feed.on = 1;
+    e_clear();
+    int lineno = 0;
+    for (char *line = strtok(script, "\n"); line; line = strtok(NULL, "\n")) {
+        lineno++;
+        if (*line == '#' || *line == '\0') {
+            continue;
+        }
+        char label[32];
+        snprintf(label, sizeof(label), "%s", line);
+        if (bench_replay_line(line, label) == -1) {
+            fflush(stdout);
+            fprintf(stderr, "%s:%d: bad op: %s\n", name, lineno, label);
+            return 1;
+        }
+    }
+    printf("  %ld frames, %.1f bytes/frame\n", E.stats.frames,
+           E.stats.frames ? (double)E.stats.bytes / E.stats.frames : 0.0);
+    e_close();
+    close(E.out);
+    return 0;
+}
+
+static int bench_replay(char *script_path, char *path) {
+    size_t len;
+    char *script = bench_load(script_path, 0, &len);
+    if (script == NULL) {
+        return 1;
+    }
+    int r = bench_replay_script(script, script_path, path);
+    free(script);
+    return r;
+}
+
+int e_bench(int argc, char **argv) {
+    if (!strcmp(argv[0], "replay") && argc > 1) {
+        return bench_replay(argv[1], argc > 2 ? argv[2] : NULL);
+    }
+    fprintf(stderr, "unknown benchmark: %s\n", argv[0]);
+    return 1;
 }